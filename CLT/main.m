@@ -30,6 +30,7 @@
 #import "XLTelnetServerLogger.h"
 #import "XLHTTPServerLogger.h"
 #import "XLTCPClientLogger.h"
+#import "XLFlightRecorderLogger.h"
 
 extern void c_test();
 
@@ -44,8 +45,28 @@ static void _RunLoopTimerCallBack(CFRunLoopTimerRef timer, void* info) {
   _counter += 1;
 }
 
+// Prints the log records from a XLFlightRecorderLogger file e.g. recovered after a crash
+static int _DecodeFlightRecorderFile(const char* path) {
+  XLStandardLogger* logger = [XLStandardLogger sharedOutputLogger];
+  logger.format = @"%d [%L] (%g) %m";
+  logger.tagPlaceholder = @"-";
+  BOOL success = [XLFlightRecorderLogger enumerateRecordsInFileAtPath:[NSString stringWithUTF8String:path]
+                                                           usingBlock:^(XLLogRecord* record, BOOL* stop) {
+                                                             fputs([[logger formatRecord:record] UTF8String], stdout);
+                                                           }];
+  if (!success) {
+    fprintf(stderr, "Invalid flight recorder file at \"%s\"\n", path);
+    return 1;
+  }
+  return 0;
+}
+
 int main(int argc, const char* argv[]) {
   @autoreleasepool {
+    if ((argc == 3) && !strcmp(argv[1], "--decode-flight-recorder")) {
+      return _DecodeFlightRecorderFile(argv[2]);
+    }
+
     [[XLStandardLogger sharedErrorLogger] setFormat:@"%t (%g) %l > %m%c"];
     [XLSharedFacility addLogger:[[XLTelnetServerLogger alloc] init]];
     [XLSharedFacility addLogger:[[XLHTTPServerLogger alloc] init]];
@@ -34,10 +34,13 @@
 #import <asl.h>
 
 #import "XLFacilityMacros.h"
+#import "XLFacilityCMacros.h"  // Only declares XLLogCMessage() after XLFacilityMacros.h
+#import "XLFunctions.h"
 #import "XLStandardLogger.h"
 #import "XLCallbackLogger.h"
 #import "XLFileLogger.h"
 #import "XLDatabaseLogger.h"
+#import "XLFlightRecorderLogger.h"
 #import "XLASLLogger.h"
 #import "XLTelnetServerLogger.h"
 #import "XLHTTPServerLogger.h"
@@ -115,12 +118,29 @@ typedef void (^TCPServerConnectionBlock)(GCDTCPPeerConnection* connection);
                     }]];
 }
 
+// Waits for all loggers to have processed the log records sent to XLFacility so far
+- (void)waitForLoggers {
+  NSSet* loggers = XLSharedFacility.loggers;
+  dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+  for (XLLogger* logger in loggers) {
+    [logger executeFenceBlock:^{
+      dispatch_semaphore_signal(semaphore);
+    }];
+  }
+  for (NSUInteger i = 0; i < loggers.count; ++i) {
+    dispatch_semaphore_wait(semaphore, DISPATCH_TIME_FOREVER);
+  }
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+  dispatch_release(semaphore);
+#endif
+}
+
 - (void)testLoggingLevels {
   XLOG_VERBOSE(@"Hello Verbose World!");
   XLOG_INFO(@"Hello Info World!");
   XLOG_WARNING(@"Hello Warning World!");
   XLOG_ERROR(@"Hello Error World!");
-  usleep(kLoggingDelay);
+  [self waitForLoggers];
 
   XCTAssertEqual(_capturedRecords.count, 4);
   XLLogRecord* record = _capturedRecords[1];
@@ -128,6 +148,189 @@ typedef void (^TCPServerConnectionBlock)(GCDTCPPeerConnection* connection);
   XCTAssertEqualObjects(record.message, @"Hello Info World!");
 }
 
+- (void)testDurableLoggers {
+  XLCallbackLogger* logger = [XLCallbackLogger loggerWithCallback:^(XLCallbackLogger* callbackLogger, XLLogRecord* record) {
+    usleep(5 * kLoggingDelay);
+  }];
+  logger.durable = YES;
+  [XLSharedFacility addLogger:logger];
+  XLSharedFacility.durableLoggersTimeout = 0.1;
+
+  CFAbsoluteTime time = CFAbsoluteTimeGetCurrent();
+  XLOG_ERROR(@"Hello World #1!");
+  XCTAssertGreaterThanOrEqual(CFAbsoluteTimeGetCurrent() - time, 0.1);  // Waited on the logger but not past the timeout
+  XCTAssertLessThan(CFAbsoluteTimeGetCurrent() - time, 0.4);
+
+  logger.durable = NO;
+  time = CFAbsoluteTimeGetCurrent();
+  XLOG_ERROR(@"Hello World #2!");
+  XCTAssertLessThan(CFAbsoluteTimeGetCurrent() - time, 0.1);  // Non-durable loggers are never waited on
+
+  XLSharedFacility.durableLoggersTimeout = 5.0;
+  [XLSharedFacility removeLogger:logger];
+  [self waitForLoggers];
+  XCTAssertEqual(_capturedRecords.count, 2);
+}
+
+- (void)testLazyCallstack {
+  XLSharedFacility.minCaptureCallstackLevel = kXLLogLevel_Warning;
+  for (int i = 0; i < 2; ++i) {
+    XLOG_WARNING(@"Hello World!");
+  }
+  XLSharedFacility.minCaptureCallstackLevel = kXLLogLevel_Exception;
+  [self waitForLoggers];
+
+  XCTAssertEqual(_capturedRecords.count, 2);
+  NSArray* callstack = [_capturedRecords[0] callstack];
+  XCTAssertGreaterThan(callstack.count, 2);
+  XCTAssertTrue([callstack[0] hasPrefix:@"0   "]);
+  XCTAssertNotEqual([[callstack componentsJoinedByString:@"\n"] rangeOfString:@"testLazyCallstack"].location, NSNotFound);
+  XCTAssertEqualObjects([_capturedRecords[1] callstack], callstack);  // Same frames resolve to the same symbols
+}
+
+- (void)testMonotonicTime {
+  for (int i = 0; i < 100; ++i) {
+    XLOG_INFO(@"%i", i);
+  }
+  [self waitForLoggers];
+
+  XCTAssertEqual(_capturedRecords.count, 100);
+  for (NSUInteger i = 1; i < _capturedRecords.count; ++i) {
+    XCTAssertGreaterThanOrEqual([_capturedRecords[i] monotonicTime], [_capturedRecords[i - 1] monotonicTime]);
+    XCTAssertGreaterThanOrEqual([_capturedRecords[i] absoluteTime], [_capturedRecords[i - 1] absoluteTime]);
+  }
+  XCTAssertEqualWithAccuracy([_capturedRecords.lastObject absoluteTime], CFAbsoluteTimeGetCurrent(), 1.0);
+  XCTAssertEqualWithAccuracy(XLAbsoluteTimeFromMonotonicTime(XLGetMonotonicTime()), CFAbsoluteTimeGetCurrent(), 0.01);
+}
+
+- (void)testCMessages {
+  char longString[2048];
+  memset(longString, 'x', sizeof(longString) - 1);
+  longString[sizeof(longString) - 1] = 0;
+  char tag[] = "c-tag";
+  XLLogCMessage(tag, kXLLogLevel_Info, "Hello %s #%i", "World", 1);
+  XLLogCMessage(tag, kXLLogLevel_Info, "%s", longString);
+  strcpy(tag, "c-new");  // Same address but different contents
+  XLLogCMessage(tag, kXLLogLevel_Info, "%@", @"Hello World!");
+  XLLogCMessage(NULL, kXLLogLevel_Warning, "Hello World!");
+  XLLogCMessage(NULL, kXLLogLevel_Debug, "Hello World!");  // Below minimum log level
+  [self waitForLoggers];
+
+  XCTAssertEqual(_capturedRecords.count, 4);
+  XCTAssertEqualObjects([_capturedRecords[0] tag], @"c-tag");
+  XCTAssertEqualObjects([_capturedRecords[0] message], @"Hello World #1");
+  XCTAssertEqual([_capturedRecords[1] tag], [_capturedRecords[0] tag]);  // Tags are interned
+  XCTAssertEqual([[_capturedRecords[1] message] length], sizeof(longString) - 1);
+  XCTAssertEqualObjects([_capturedRecords[2] tag], @"c-new");
+  XCTAssertEqualObjects([_capturedRecords[2] message], @"Hello World!");
+  XCTAssertNil([_capturedRecords[3] tag]);
+  XCTAssertEqual([_capturedRecords[3] level], kXLLogLevel_Warning);
+}
+
+- (void)testLogSites {
+  for (int i = 0; i < 2; ++i) {
+    XLOG_WARNING(@"Hello World #%i!", i);
+  }
+  static XLLogSite site = XL_LOG_SITE_INITIALIZER(kXLLogLevel_Info);
+  [XLSharedFacility logMessageWithSite:&site tag:@"site" format:@"Bonjour le monde!"];
+  [self waitForLoggers];
+
+  XCTAssertEqual(_capturedRecords.count, 3);
+  XCTAssertEqual([_capturedRecords[0] tag], [_capturedRecords[1] tag]);  // Tags are interned once per log site
+  XCTAssertEqualObjects([_capturedRecords[1] message], @"Hello World #1!");
+  XCTAssertEqual(site.line, __LINE__ - 7);
+  XCTAssertEqual(strcmp(site.file, __FILE__), 0);
+  XCTAssertEqualObjects(site.tag, @"site");
+  XLLogRecord* record = _capturedRecords[2];
+  XCTAssertEqual(record.level, kXLLogLevel_Info);
+  XCTAssertEqualObjects(record.tag, @"site");
+}
+
+- (void)testLogLevelOverrides {
+  [XLSharedFacility setMinLogLevel:kXLLogLevel_Warning];
+  [XLSharedFacility setMinLogLevel:kXLLogLevel_Debug forTag:@"noisy"];
+  static XLLogSite site1 = XL_LOG_SITE_INITIALIZER(kXLLogLevel_Verbose);
+  static XLLogSite site2 = XL_LOG_SITE_INITIALIZER(kXLLogLevel_Verbose);
+  [XLSharedFacility logMessageWithSite:&site1 tag:@"noisy" format:@"Hello World #1!"];
+  [XLSharedFacility logMessageWithSite:&site2 tag:@"quiet" format:@"Hello World #2!"];
+  [XLSharedFacility logMessageWithTag:@"noisy" level:kXLLogLevel_Verbose format:@"Hello World #3!"];
+  [XLSharedFacility logMessageWithTag:@"quiet" level:kXLLogLevel_Verbose format:@"Hello World #4!"];
+  XCTAssertTrue(site1.enabled);
+  XCTAssertFalse(site2.enabled);
+
+  NSString* file = [@__FILE__ lastPathComponent];
+  [XLSharedFacility setMinLogLevel:kXLMuteLogLevel forLogSitesInFile:file line:site1.line];
+  XCTAssertFalse(site1.enabled);
+  [XLSharedFacility removeMinLogLevelForLogSitesInFile:file line:site1.line];
+  XCTAssertTrue(site1.enabled);
+  [XLSharedFacility removeMinLogLevelForTag:@"noisy"];
+  XCTAssertFalse(site1.enabled);
+  [XLSharedFacility setMinLogLevel:kXLLogLevel_Verbose];
+  XCTAssertTrue(site1.enabled);
+  XCTAssertTrue(site2.enabled);
+  [self waitForLoggers];
+
+  XCTAssertEqual(_capturedRecords.count, 2);
+  XCTAssertEqualObjects([_capturedRecords[0] message], @"Hello World #1!");
+  XCTAssertEqualObjects([_capturedRecords[1] message], @"Hello World #3!");
+}
+
+- (void)testEffectiveMinLogLevel {
+  [XLSharedFacility removeAllLoggers];
+  XCTAssertEqual(XLMinLogLevel, kXLLogLevel_Verbose);  // Not affected by loggers
+
+  XLCallbackLogger* logger = [XLCallbackLogger loggerWithCallback:^(XLCallbackLogger* callbackLogger, XLLogRecord* record) {
+    [_capturedRecords addObject:record];
+  }];
+  logger.minLogLevel = kXLLogLevel_Warning;
+  [XLSharedFacility addLogger:logger];
+  XCTAssertEqual(XLMinLogLevel, kXLLogLevel_Verbose);
+  XCTAssertEqual(XLSharedFacility.minLogLevel, kXLLogLevel_Verbose);
+
+  static XLLogSite site = XL_LOG_SITE_INITIALIZER(kXLLogLevel_Info);
+  [XLSharedFacility logMessageWithSite:&site tag:nil format:@"Hello World #1!"];
+  XCTAssertFalse(site.enabled);
+
+  logger.minLogLevel = kXLLogLevel_Info;
+  XCTAssertTrue(site.enabled);
+  [XLSharedFacility logMessageWithSite:&site tag:nil format:@"Hello World #2!"];
+
+  XLMinLogLevel = kXLLogLevel_Error;  // Modifying the global variable directly is equivalent to setting the property
+  XCTAssertEqual(XLSharedFacility.minLogLevel, kXLLogLevel_Error);
+  XCTAssertNotEqual(site.minLogLevel, XLMinLogLevel);  // Log sites are updated on their next use
+  [XLSharedFacility logMessageWithSite:&site tag:nil format:@"Hello World #3!"];
+  XCTAssertFalse(site.enabled);
+  XLMinLogLevel = kXLLogLevel_Verbose;
+  [XLSharedFacility logMessageWithSite:&site tag:nil format:@"Hello World #4!"];
+  XCTAssertTrue(site.enabled);
+  [self waitForLoggers];
+
+  XCTAssertEqual(_capturedRecords.count, 2);
+  XCTAssertEqualObjects([_capturedRecords[0] message], @"Hello World #2!");
+  XCTAssertEqualObjects([_capturedRecords[1] message], @"Hello World #4!");
+
+  [XLSharedFacility removeLogger:logger];
+}
+
+- (void)testDeferredFormatting {
+  XLSharedFacility.defersMessageFormatting = YES;
+
+  NSMutableString* string = [[NSMutableString alloc] initWithString:@"Hello"];
+  XLOG_INFO(@"%i|%05.2f|%*d|%s|%@|%@|%lu|%llx|%% done", -42, M_PI, 6, 7, "World", string, nil, (unsigned long)1234, 0xDEADBEEFULL);
+  [string appendString:@" World"];
+  XLOG_INFO(@"%1$@ %1$@", string);  // Positional arguments are formatted immediately
+  char bytes[4] = {'a', 'b', 'c', 'd'};  // Not NUL-terminated
+  XLOG_INFO(@"%.4s|%.*s|%-6.3s|", bytes, 2, bytes, bytes);
+  [self waitForLoggers];
+
+  XCTAssertEqual(_capturedRecords.count, 3);
+  XCTAssertEqualObjects([_capturedRecords[0] message], @"-42|03.14|     7|World|Hello|(null)|1234|deadbeef|% done");
+  XCTAssertEqualObjects([_capturedRecords[1] message], @"Hello World Hello World");
+  XCTAssertEqualObjects([_capturedRecords[2] message], @"abcd|ab|abc   |");
+
+  XLSharedFacility.defersMessageFormatting = NO;
+}
+
 - (void)testCapturingInitializedException {
   [XLSharedFacility setLogsInitializedExceptions:YES];
 
@@ -137,7 +340,7 @@ typedef void (^TCPServerConnectionBlock)(GCDTCPPeerConnection* connection);
   @catch (NSException* exception) {
 #pragma unused(exception)
   }
-  usleep(kLoggingDelay);
+  [self waitForLoggers];
 
   XCTAssertEqual(_capturedRecords.count, 1);
   XLLogRecord* record = _capturedRecords[0];
@@ -154,7 +357,7 @@ typedef void (^TCPServerConnectionBlock)(GCDTCPPeerConnection* connection);
   @catch (NSException* exception) {
 #pragma unused(exception)
   }
-  usleep(kLoggingDelay);
+  [self waitForLoggers];
 
   XCTAssertEqual(_capturedRecords.count, 1);
 }
@@ -195,7 +398,7 @@ typedef void (^TCPServerConnectionBlock)(GCDTCPPeerConnection* connection);
   for (int i = 0; i < 10; ++i) {
     [XLSharedFacility logMessageWithTag:XLOG_TAG level:(1 + i % 4) format:@"Hello World #%i!", i + 1];
   }
-  usleep(kLoggingDelay);
+  [self waitForLoggers];
 
   NSString* contents = [[NSString alloc] initWithContentsOfFile:filePath encoding:NSUTF8StringEncoding error:NULL];
   XCTAssertEqualObjects(contents, @"\
@@ -215,6 +418,350 @@ typedef void (^TCPServerConnectionBlock)(GCDTCPPeerConnection* connection);
   [[NSFileManager defaultManager] removeItemAtPath:filePath error:NULL];
 }
 
+- (void)testBatchedFileLogger {
+  NSString* filePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+  XLFileLogger* logger = [[XLFileLogger alloc] initWithFilePath:filePath append:NO];
+  logger.format = @"%m";
+  logger.maxBatchSize = 100;
+  logger.maxBatchLatency = 0.05;
+  [XLSharedFacility addLogger:logger];
+
+  for (int i = 0; i < 1000; ++i) {
+    XLOG_INFO(@"%i", i);
+  }
+  [self waitForLoggers];
+
+  NSString* contents = [[NSString alloc] initWithContentsOfFile:filePath encoding:NSUTF8StringEncoding error:NULL];
+  NSArray* lines = [contents componentsSeparatedByString:@"\n"];
+  XCTAssertEqual(lines.count, 1001);
+  for (int i = 0; i < 1000; ++i) {
+    XCTAssertEqual([lines[i] intValue], i);
+  }
+
+  [XLSharedFacility removeLogger:logger];
+  [[NSFileManager defaultManager] removeItemAtPath:filePath error:NULL];
+}
+
+- (void)testBufferedFileLogger {
+  NSString* filePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+  XLFileLogger* logger = [[XLFileLogger alloc] initWithFilePath:filePath append:NO];
+  logger.format = @"%m";
+  logger.bufferSize = 4096;
+  logger.flushInterval = 0.0;
+  logger.flushLevel = kXLLogLevel_Abort;
+  [XLSharedFacility addLogger:logger];
+
+  XLOG_INFO(@"Hello World #1!");
+  XLOG_ERROR(@"Hello World #2!");  // Returns once durable loggers have processed the log record which is below the flush level
+  XCTAssertEqualObjects([[NSString alloc] initWithContentsOfFile:filePath encoding:NSUTF8StringEncoding error:NULL], @"");
+
+  logger.flushLevel = kXLLogLevel_Error;
+  XLOG_ERROR(@"Hello World #3!");  // Flushes buffered records
+  XCTAssertEqualObjects([[NSString alloc] initWithContentsOfFile:filePath encoding:NSUTF8StringEncoding error:NULL], @"Hello World #1!\nHello World #2!\nHello World #3!\n");
+
+  XLOG_INFO(@"Hello World #4!");
+  XCTestExpectation* expectation = [self expectationWithDescription:@""];
+  [logger executeFenceBlock:^{  // Fences flush buffered records before executing
+    [expectation fulfill];
+  }];
+  [self waitForExpectationsWithTimeout:1.0 handler:NULL];
+  XCTAssertEqualObjects([[NSString alloc] initWithContentsOfFile:filePath encoding:NSUTF8StringEncoding error:NULL], @"Hello World #1!\nHello World #2!\nHello World #3!\nHello World #4!\n");
+
+  logger.flushInterval = 0.1;
+  XLOG_INFO(@"Hello World #5!");
+  NSString* contents = @"Hello World #1!\nHello World #2!\nHello World #3!\nHello World #4!\nHello World #5!\n";
+  NSPredicate* predicate = [NSPredicate predicateWithBlock:^BOOL(NSString* path, NSDictionary* bindings) {
+    return [[[NSString alloc] initWithContentsOfFile:path encoding:NSUTF8StringEncoding error:NULL] isEqualToString:contents];
+  }];
+  [self expectationForPredicate:predicate evaluatedWithObject:filePath handler:NULL];  // Poll until the flush interval has elapsed
+  [self waitForExpectationsWithTimeout:5.0 handler:NULL];
+
+  [XLSharedFacility removeLogger:logger];
+  [[NSFileManager defaultManager] removeItemAtPath:filePath error:NULL];
+}
+
+- (void)testRotatingFileLogger {
+  NSString* filePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+  XLFileLogger* logger = [[XLFileLogger alloc] initWithFilePath:filePath append:NO];
+  logger.format = @"%m";
+  logger.maximumFileSize = 30;
+  logger.maximumRotatedFiles = 2;
+  [XLSharedFacility addLogger:logger];
+
+  for (int i = 1; i <= 8; ++i) {
+    XLOG_INFO(@"Rotation #%i!", i);  // 13 bytes per record so 2 records per file
+  }
+  [self waitForLoggers];
+  XCTAssertEqualObjects([[NSString alloc] initWithContentsOfFile:filePath encoding:NSUTF8StringEncoding error:NULL], @"Rotation #7!\nRotation #8!\n");
+  [XLSharedFacility removeLogger:logger];  // Closing waits for rotated files to be compressed on the background queue
+
+  NSString* directoryPath = [filePath stringByDeletingLastPathComponent];
+  NSString* prefix = [[filePath lastPathComponent] stringByAppendingString:@"."];
+  NSMutableArray* rotatedPaths = [[NSMutableArray alloc] init];
+  for (NSString* name in [[NSFileManager defaultManager] contentsOfDirectoryAtPath:directoryPath error:NULL]) {
+    if ([name hasPrefix:prefix]) {
+      XCTAssertEqualObjects(name.pathExtension, @"gz");
+      [rotatedPaths addObject:[directoryPath stringByAppendingPathComponent:name]];
+    }
+  }
+  XCTAssertEqual(rotatedPaths.count, 2);
+
+  for (NSString* path in rotatedPaths) {
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+  }
+  [[NSFileManager defaultManager] removeItemAtPath:filePath error:NULL];
+}
+
+- (void)testFileLoggerFormatting {
+  NSString* filePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+  XLFileLogger* logger = [[XLFileLogger alloc] initWithFilePath:filePath append:NO];
+  logger.format = @"(%g) %l \\\\ %m";
+  logger.tagPlaceholder = @"-";
+  logger.multilinesPrefix = @"\t";
+  [XLSharedFacility addLogger:logger];
+
+  [XLSharedFacility logMessage:@"Hello World!" withTag:nil level:kXLLogLevel_Info];
+  [XLSharedFacility logMessage:@"Ça va?\nTrès bien 😀\n\nMerci" withTag:@"überTag" level:kXLLogLevel_Warning];
+  [self waitForLoggers];
+
+  NSString* contents = [[NSString alloc] initWithContentsOfFile:filePath encoding:NSUTF8StringEncoding error:NULL];
+  XCTAssertEqualObjects(contents, @"\
+(-) INFO \\ Hello World!\n\
+(überTag) WARNING \\ Ça va?\n\
+\tTrès bien 😀\n\
+\n\
+\tMerci\n\
+");
+
+  [XLSharedFacility removeLogger:logger];
+  [[NSFileManager defaultManager] removeItemAtPath:filePath error:NULL];
+}
+
+- (void)testJSONLinesFormatting {
+  NSString* filePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+  XLFileLogger* logger = [[XLFileLogger alloc] initWithFilePath:filePath append:NO];
+  logger.format = XLLoggerFormatString_JSONLines;
+  [XLSharedFacility addLogger:logger];
+
+  CFAbsoluteTime time = CFAbsoluteTimeGetCurrent() + kCFAbsoluteTimeIntervalSince1970;
+  [XLSharedFacility logMessage:@"Hello \"World\"\n\tfrom XLFacility \\o/ 😀" withTag:@"json" level:kXLLogLevel_Warning metadata:@{ @"a" : @"1" }];
+  [XLSharedFacility logMessage:@"Bonjour le monde!" withTag:nil level:kXLLogLevel_Info];
+  [self waitForLoggers];
+
+  NSString* contents = [[NSString alloc] initWithContentsOfFile:filePath encoding:NSUTF8StringEncoding error:NULL];
+  NSArray* lines = [contents componentsSeparatedByString:@"\n"];
+  XCTAssertEqual(lines.count, 3);
+  NSDictionary* object1 = [NSJSONSerialization JSONObjectWithData:[lines[0] dataUsingEncoding:NSUTF8StringEncoding] options:0 error:NULL];
+  XCTAssertEqualWithAccuracy([object1[@"time"] doubleValue], time, 1.0);
+  XCTAssertEqualObjects(object1[@"tag"], @"json");
+  XCTAssertEqualObjects(object1[@"level"], @"WARNING");
+  XCTAssertEqualObjects(object1[@"message"], @"Hello \"World\"\n\tfrom XLFacility \\o/ 😀");
+  XCTAssertEqualObjects(object1[@"metadata"], @{ @"a" : @"1" });
+  XCTAssertNotNil(object1[@"errno"]);
+  XCTAssertNotNil(object1[@"thread"]);
+  NSDictionary* object2 = [NSJSONSerialization JSONObjectWithData:[lines[1] dataUsingEncoding:NSUTF8StringEncoding] options:0 error:NULL];
+  XCTAssertEqualObjects(object2[@"message"], @"Bonjour le monde!");
+  XCTAssertNil(object2[@"tag"]);
+  XCTAssertNil(object2[@"metadata"]);
+
+  [XLSharedFacility removeLogger:logger];
+  [[NSFileManager defaultManager] removeItemAtPath:filePath error:NULL];
+}
+
+- (void)testSanitizedMessages {
+  XLOG_INFO(@"Hello\r\nWorld\rfrom\u2028XLFacility!\n");
+  XLOG_INFO(@"Hello World!");
+  [self waitForLoggers];
+  XCTAssertEqual(_capturedRecords.count, 2);
+
+  XLCallbackLogger* logger = [XLCallbackLogger loggerWithCallback:^(XLCallbackLogger* logger, XLLogRecord* record){}];
+  logger.format = @"%M";
+  logger.multilinesPrefix = @"> ";
+  XCTAssertEqualObjects([logger sanitizeMessageFromRecord:_capturedRecords[0]], @"Hello\nWorld\nfrom\nXLFacility!\n");
+  XCTAssertEqualObjects([logger formatRecord:_capturedRecords[0]], @"Hello\n> World\n> from\n> XLFacility!\n\n");
+  XCTAssertEqual([logger sanitizeMessageFromRecord:_capturedRecords[1]], [_capturedRecords[1] message]);
+}
+
+- (void)testSharedFormatting {
+  NSMutableArray* filePaths = [[NSMutableArray alloc] init];
+  NSMutableArray* loggers = [[NSMutableArray alloc] init];
+  for (int i = 0; i < 3; ++i) {
+    NSString* filePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+    XLFileLogger* logger = [[XLFileLogger alloc] initWithFilePath:filePath append:NO];
+    logger.format = (i < 2 ? @"[%L] %m" : @"%m");  // First two loggers format records only once between them
+    [XLSharedFacility addLogger:logger];
+    [filePaths addObject:filePath];
+    [loggers addObject:logger];
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    XLOG_WARNING(@"Hello World #%i!", i + 1);
+  }
+  [self waitForLoggers];
+
+  for (int i = 0; i < 3; ++i) {
+    NSString* contents = [[NSString alloc] initWithContentsOfFile:filePaths[i] encoding:NSUTF8StringEncoding error:NULL];
+    XCTAssertEqualObjects(contents, (i < 2 ? @"[WARNING  ] Hello World #1!\n[WARNING  ] Hello World #2!\n[WARNING  ] Hello World #3!\n" : @"Hello World #1!\nHello World #2!\nHello World #3!\n"));
+    [XLSharedFacility removeLogger:loggers[i]];
+    [[NSFileManager defaultManager] removeItemAtPath:filePaths[i] error:NULL];
+  }
+}
+
+- (void)testDateTimeFormatting {
+  XLOG_INFO(@"Hello World #1!");
+  usleep(1500 * 1000);
+  XLOG_INFO(@"Hello World #2!");
+  [self waitForLoggers];
+  XCTAssertEqual(_capturedRecords.count, 2);
+
+  XLCallbackLogger* logger = [XLCallbackLogger loggerWithCallback:^(XLCallbackLogger* logger, XLLogRecord* record){}];
+  logger.format = @"%d";
+  logger.appendNewlineToFormat = NO;
+  for (int i = 0; i < 2; ++i) {  // Second iteration hits the per-second cache
+    for (XLLogRecord* record in _capturedRecords) {
+      XCTAssertEqualObjects([logger formatRecord:record], [logger.datetimeFormatter stringFromDate:[NSDate dateWithTimeIntervalSinceReferenceDate:record.absoluteTime]]);
+    }
+  }
+
+  logger.datetimeFormatter.dateFormat = @"HH:mm:ss.SSS yyyy";
+  XLLogRecord* record = _capturedRecords[0];
+  XCTAssertEqualObjects([logger formatRecord:record], [logger.datetimeFormatter stringFromDate:[NSDate dateWithTimeIntervalSinceReferenceDate:record.absoluteTime]]);
+}
+
+- (void)testFlightRecorderLogger {
+  NSString* filePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+  XLFlightRecorderLogger* logger = [[XLFlightRecorderLogger alloc] initWithFilePath:filePath recordCount:8 recordSize:64];
+  [XLSharedFacility addLogger:logger];
+  for (int i = 0; i < 12; ++i) {
+    XLOG_INFO(@"Hello World #%i!", i);
+  }
+  XLOG_WARNING(@"%@", [@"" stringByPaddingToLength:100 withString:@"x" startingAtIndex:0]);
+  [XLSharedFacility removeLogger:logger];  // Log records are written synchronously so there is no need to wait
+
+  NSMutableArray* records = [[NSMutableArray alloc] init];
+  XCTAssertTrue([XLFlightRecorderLogger enumerateRecordsInFileAtPath:filePath
+                                                          usingBlock:^(XLLogRecord* record, BOOL* stop) {
+                                                            [records addObject:record];
+                                                          }]);
+  XCTAssertEqual(records.count, 8);  // Only the most recent log records remain in the ring
+  XCTAssertEqualObjects([records[0] message], @"Hello World #5!");
+  XCTAssertEqualObjects([records[0] tag], XLOG_TAG);
+  XCTAssertEqual([records[0] level], kXLLogLevel_Info);
+  XCTAssertEqualWithAccuracy([records[0] absoluteTime], CFAbsoluteTimeGetCurrent(), 1.0);
+  XCTAssertEqual([records.lastObject level], kXLLogLevel_Warning);
+  XCTAssertGreaterThan([[records.lastObject message] length], 0);
+  XCTAssertLessThan([[records.lastObject message] length], 100);  // Truncated to fit
+
+  // Reopening the same file appends to the existing log records
+  logger = [[XLFlightRecorderLogger alloc] initWithFilePath:filePath recordCount:8 recordSize:64];
+  [XLSharedFacility addLogger:logger];
+  XLOG_INFO(@"Hello again!");
+  [XLSharedFacility removeLogger:logger];
+  [records removeAllObjects];
+  XCTAssertTrue([XLFlightRecorderLogger enumerateRecordsInFileAtPath:filePath
+                                                          usingBlock:^(XLLogRecord* record, BOOL* stop) {
+                                                            [records addObject:record];
+                                                          }]);
+  XCTAssertEqual(records.count, 8);
+  XCTAssertEqualObjects([records[0] message], @"Hello World #6!");
+  XCTAssertEqualObjects([records.lastObject message], @"Hello again!");
+
+  [[NSFileManager defaultManager] removeItemAtPath:filePath error:NULL];
+}
+
+- (void)testSignalSafeLogging {
+  NSString* filePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+  NSString* recorderPath = [filePath stringByAppendingPathExtension:@"bin"];
+  XLFlightRecorderLogger* logger = [[XLFlightRecorderLogger alloc] initWithFilePath:recorderPath];
+  [XLSharedFacility addLogger:logger];
+  int fd = open([filePath fileSystemRepresentation], O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+  XCTAssertTrue(XLRegisterSignalSafeFileDescriptor(fd));
+
+  XLLogSignalSafeMessage("signal", kXLLogLevel_Abort, "Received SIGSEGV");
+  XLLogSignalSafeCallstack(NULL, kXLLogLevel_Abort);
+  XLUnregisterSignalSafeFileDescriptor(fd);
+  XLLogSignalSafeMessage(NULL, kXLLogLevel_Abort, "Not written to file");
+  close(fd);
+  [XLSharedFacility removeLogger:logger];
+
+  NSString* contents = [[NSString alloc] initWithContentsOfFile:filePath encoding:NSUTF8StringEncoding error:NULL];
+  XCTAssertTrue([contents hasPrefix:@"[ABORT    ]> (signal) Received SIGSEGV\n[ABORT    ]> Callstack:\n"]);
+  XCTAssertNotEqual([contents rangeOfString:@"Callstack:\n[ABORT    ]> 0x"].location, NSNotFound);  // Raw frame addresses only
+  XCTAssertEqual([contents rangeOfString:@"Not written to file"].location, NSNotFound);
+  XCTAssertEqual(_capturedRecords.count, 0);  // XLFacility is bypassed entirely
+
+  NSMutableArray* records = [[NSMutableArray alloc] init];
+  XCTAssertTrue([XLFlightRecorderLogger enumerateRecordsInFileAtPath:recorderPath
+                                                          usingBlock:^(XLLogRecord* record, BOOL* stop) {
+                                                            [records addObject:record];
+                                                          }]);
+  XCTAssertGreaterThan(records.count, 3);
+  XCTAssertEqualObjects([records[0] tag], @"signal");
+  XCTAssertEqualObjects([records[0] message], @"Received SIGSEGV");
+  XCTAssertEqualObjects([records[1] message], @"Callstack:");
+  XCTAssertTrue([[records[2] message] hasPrefix:@"0x"]);
+  XCTAssertEqualObjects([records.lastObject message], @"Not written to file");
+
+  [[NSFileManager defaultManager] removeItemAtPath:filePath error:NULL];
+  [[NSFileManager defaultManager] removeItemAtPath:recorderPath error:NULL];
+}
+
+- (void)testLoggerBackpressure {
+  NSMutableArray* records = [[NSMutableArray alloc] init];
+  XLCallbackLogger* logger = [XLCallbackLogger loggerWithCallback:^(XLCallbackLogger* callbackLogger, XLLogRecord* record) {
+    [records addObject:record];
+    usleep(1000);
+  }];
+  logger.maxPendingRecords = 10;
+  logger.overflowPolicy = kXLLoggerOverflowPolicy_DropNewest;
+  [XLSharedFacility addLogger:logger];
+
+  for (int i = 0; i < 200; ++i) {
+    XLOG_INFO(@"%i", i);
+  }
+  [self waitForLoggers];
+
+  XCTAssertGreaterThan(logger.droppedRecordCount, 0);
+  NSUInteger reportCount = 0;
+  NSUInteger reportedDropCount = 0;
+  for (XLLogRecord* record in records) {  // A drop report is sent every time the queue empties so there can be several
+    if ([record.tag isEqualToString:XLFacilityTag_Internal]) {
+      XCTAssertEqual(record.level, kXLLogLevel_Warning);
+      XCTAssertNotEqual([record.message rangeOfString:@" log records dropped"].location, NSNotFound);
+      reportCount += 1;
+      reportedDropCount += (NSUInteger)[record.message integerValue];
+    }
+  }
+  XCTAssertGreaterThan(reportCount, 0);
+  XCTAssertEqual(reportedDropCount, logger.droppedRecordCount);
+  XCTAssertEqual(records.count - reportCount + logger.droppedRecordCount, 200);
+  XCTAssertEqualObjects([records.lastObject tag], XLFacilityTag_Internal);
+
+  [XLSharedFacility removeLogger:logger];
+}
+
+- (void)testLoggerBlockingBackpressure {
+  NSMutableArray* records = [[NSMutableArray alloc] init];
+  XLCallbackLogger* slowLogger = [XLCallbackLogger loggerWithCallback:^(XLCallbackLogger* callbackLogger, XLLogRecord* record) {
+    [records addObject:record];
+    usleep(1000);
+  }];
+  slowLogger.maxPendingRecords = 2;
+  slowLogger.overflowPolicy = kXLLoggerOverflowPolicy_Block;
+  [XLSharedFacility addLogger:slowLogger];
+
+  for (int i = 0; i < 50; ++i) {
+    XLOG_INFO(@"%i", i);
+  }
+  [self waitForLoggers];
+
+  XCTAssertEqual(slowLogger.droppedRecordCount, 0);
+  XCTAssertEqual(records.count, 50);
+  XCTAssertEqual(_capturedRecords.count, 50);  // Other loggers are not affected
+
+  [XLSharedFacility removeLogger:slowLogger];
+}
+
 - (void)testDatabaseLogger {
   NSString* databasePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
   XLDatabaseLogger* logger = [[XLDatabaseLogger alloc] initWithDatabasePath:databasePath appVersion:0];
@@ -228,7 +775,7 @@ typedef void (^TCPServerConnectionBlock)(GCDTCPPeerConnection* connection);
     }
     [XLSharedFacility logMessageWithTag:XLOG_TAG level:(i % 5) metadata:metadata format:@"Hello World #%i!", i + 1];
   }
-  usleep(kLoggingDelay);
+  [self waitForLoggers];
 
   __block int index = 0;
   [logger enumerateRecordsAfterAbsoluteTime:0.0
@@ -268,6 +815,44 @@ typedef void (^TCPServerConnectionBlock)(GCDTCPPeerConnection* connection);
   [[NSFileManager defaultManager] removeItemAtPath:databasePath error:NULL];
 }
 
+- (void)testTypedMetadata {
+  NSString* databasePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+  XLDatabaseLogger* logger = [[XLDatabaseLogger alloc] initWithDatabasePath:databasePath appVersion:0];
+  [XLSharedFacility addLogger:logger];
+
+  NSMutableString* name = [NSMutableString stringWithString:@"\"Hello\"\n"];
+  XLOG_MESSAGE_WITH_METADATA(kXLLogLevel_Info, XLOG_METADATA(XLM_INT("count", 42), XLM_DOUBLE("ratio", 0.5), XLM_BOOL("flag", YES), XLM_STRING("name", name)), @"Hello World!");
+  [name setString:@"Modified"];  // String values are copied when logged
+  [XLSharedFacility logMessage:@"Hello World!" withTag:nil level:kXLLogLevel_Info metadataList:XLOG_METADATA(XLM_STRING("name", nil))];
+  [XLSharedFacility logMessage:@"Hello World!" withTag:nil level:kXLLogLevel_Info metadata:@{ @"flag" : @YES, @"ratio" : @(0.1f), @"big" : @(ULLONG_MAX) }];  // Dictionary values are rendered with -description
+  [self waitForLoggers];
+
+  XCTAssertEqual(_capturedRecords.count, 3);
+  NSDictionary* metadata = @{ @"count" : @"42",
+                              @"ratio" : @"0.5",
+                              @"flag" : @"true",
+                              @"name" : @"\"Hello\"\n" };
+  XCTAssertEqualObjects([_capturedRecords[0] metadata], metadata);
+  XCTAssertEqualObjects([_capturedRecords[1] metadata], @{ @"name" : @"(null)" });
+  NSDictionary* dictionaryMetadata = @{ @"flag" : [@YES description],
+                                        @"ratio" : [@(0.1f) description],
+                                        @"big" : [@(ULLONG_MAX) description] };
+  XCTAssertEqualObjects([_capturedRecords[2] metadata], dictionaryMetadata);
+
+  __block int index = 0;
+  [logger enumerateRecordsAfterAbsoluteTime:0.0
+                                   backward:NO
+                                 maxRecords:0
+                                 usingBlock:^(int appVersion, XLLogRecord* record, BOOL* stop) {
+                                   XCTAssertEqualObjects(record, _capturedRecords[index]);
+                                   ++index;
+                                 }];
+  XCTAssertEqual(index, 3);
+
+  [XLSharedFacility removeLogger:logger];
+  [[NSFileManager defaultManager] removeItemAtPath:databasePath error:NULL];
+}
+
 - (void)testASLLogger {
   [XLSharedFacility addLogger:[XLASLLogger sharedLogger]];
 
@@ -385,6 +970,7 @@ typedef void (^TCPServerConnectionBlock)(GCDTCPPeerConnection* connection);
 
   XLOG_INFO(@"Bonjour le monde!");
   XLOG_WARNING(@"Hello World!");
+  XLOG_WARNING(@"<b>Fish & \"Chips\"</b>\nEnjoy!");
   usleep(kLoggingDelay);
 
   CFAbsoluteTime time = CFAbsoluteTimeGetCurrent();
@@ -399,6 +985,8 @@ typedef void (^TCPServerConnectionBlock)(GCDTCPPeerConnection* connection);
   XCTAssertNotEqual(range1.location, NSNotFound);
   NSRange range2 = [string1 rangeOfString:@"Hello World!"];
   XCTAssertNotEqual(range2.location, NSNotFound);
+  NSRange range4 = [string1 rangeOfString:@"&lt;b&gt;Fish &amp; &quot;Chips&quot;&lt;/b&gt;<br>Enjoy!"];
+  XCTAssertNotEqual(range4.location, NSNotFound);
 
   XCTestExpectation* expectation = [self expectationWithDescription:@""];
   dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
@@ -515,7 +1103,7 @@ typedef void (^TCPServerConnectionBlock)(GCDTCPPeerConnection* connection);
                          level:kXLLogLevel_Verbose
                       metadata:@{ @"a" : @"1",
                                   @"b" : @2 }];
-  usleep(kLoggingDelay);
+  [self waitForLoggers];
 
   NSString* contents = [[NSString alloc] initWithContentsOfFile:filePath encoding:NSUTF8StringEncoding error:NULL];
   XCTAssertEqualObjects(contents, @"\
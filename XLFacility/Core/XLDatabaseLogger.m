@@ -64,6 +64,7 @@
   if ((self = [super init])) {
     _databasePath = [path copy];
     _appVersion = appVersion;
+    self.durable = YES;
 
     _databaseQueue = dispatch_queue_create(XL_DISPATCH_QUEUE_LABEL, DISPATCH_QUEUE_SERIAL);
   }
@@ -101,48 +102,75 @@
   return success;
 }
 
+// Must be called on _databaseQueue
+- (void)_insertRecord:(XLLogRecord*)record {
+  sqlite3_bind_double(_statement, 1, record.absoluteTime);
+  const char* tag = XLConvertNSStringToUTF8CString(record.tag);
+  if (tag) {
+    sqlite3_bind_text(_statement, 2, tag, -1, SQLITE_STATIC);
+  } else {
+    sqlite3_bind_null(_statement, 2);
+  }
+  sqlite3_bind_int(_statement, 3, record.level);
+  sqlite3_bind_text(_statement, 4, XLConvertNSStringToUTF8CString(record.message), -1, SQLITE_STATIC);
+  unsigned char metadataStorage[1024];
+  XLByteBuffer metadata;
+  XLByteBufferInit(&metadata, metadataStorage, sizeof(metadataStorage));
+  if ([record appendMetadataAsJSONToBuffer:&metadata]) {
+    sqlite3_bind_blob(_statement, 5, metadata.bytes, (int)metadata.length, SQLITE_STATIC);
+  }
+  sqlite3_bind_int(_statement, 6, record.capturedErrno);
+  sqlite3_bind_int(_statement, 7, record.capturedThreadID);
+  const char* label = XLConvertNSStringToUTF8CString(record.capturedQueueLabel);
+  if (label) {
+    sqlite3_bind_text(_statement, 8, label, -1, SQLITE_STATIC);
+  } else {
+    sqlite3_bind_null(_statement, 8);
+  }
+  const char* callstack = XLConvertNSStringToUTF8CString([record.callstack componentsJoinedByString:@"\n"]);
+  if (callstack) {
+    sqlite3_bind_text(_statement, 9, callstack, -1, SQLITE_STATIC);
+  } else {
+    sqlite3_bind_null(_statement, 9);
+  }
+  if (sqlite3_step(_statement) != SQLITE_DONE) {
+    XLOG_ERROR(@"Failed writing to database at path \"%@\": %s", _databasePath, sqlite3_errmsg(_database));
+    _disableWrites = YES; // Write errors to database are typically not recoverable and we want to avoid entering an infinite logging loop
+  }
+  sqlite3_reset(_statement);
+  sqlite3_clear_bindings(_statement);
+  XLByteBufferDestroy(&metadata);
+}
+
 - (void)logRecord:(XLLogRecord*)record {
   dispatch_sync(_databaseQueue, ^() {
     if (_disableWrites) {
       return;
     }
-    sqlite3_bind_double(_statement, 1, record.absoluteTime);
-    const char* tag = XLConvertNSStringToUTF8CString(record.tag);
-    if (tag) {
-      sqlite3_bind_text(_statement, 2, tag, -1, SQLITE_STATIC);
-    } else {
-      sqlite3_bind_null(_statement, 2);
+    [self _insertRecord:record];
+  });
+}
+
+// Insert the entire batch as a single transaction
+- (void)logRecords:(NSArray<XLLogRecord*>*)records {
+  dispatch_sync(_databaseQueue, ^() {
+    if (_disableWrites) {
+      return;
     }
-    sqlite3_bind_int(_statement, 3, record.level);
-    sqlite3_bind_text(_statement, 4, XLConvertNSStringToUTF8CString(record.message), -1, SQLITE_STATIC);
-    if (record.metadata) {
-      NSData* data = [NSJSONSerialization dataWithJSONObject:(id)record.metadata options:0 error:NULL];
-      if (data) {
-        sqlite3_bind_blob(_statement, 5, data.bytes, (int)data.length, SQLITE_STATIC);
-      } else {
-        XLOG_DEBUG_UNREACHABLE();
+    sqlite3_exec(_database, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    for (XLLogRecord* record in records) {
+      @autoreleasepool {
+        [self _insertRecord:record];
+      }
+      if (_disableWrites) {
+        break;
       }
     }
-    sqlite3_bind_int(_statement, 6, record.capturedErrno);
-    sqlite3_bind_int(_statement, 7, record.capturedThreadID);
-    const char* label = XLConvertNSStringToUTF8CString(record.capturedQueueLabel);
-    if (label) {
-      sqlite3_bind_text(_statement, 8, label, -1, SQLITE_STATIC);
-    } else {
-      sqlite3_bind_null(_statement, 8);
-    }
-    const char* callstack = XLConvertNSStringToUTF8CString([record.callstack componentsJoinedByString:@"\n"]);
-    if (callstack) {
-      sqlite3_bind_text(_statement, 9, callstack, -1, SQLITE_STATIC);
-    } else {
-      sqlite3_bind_null(_statement, 9);
-    }
-    if (sqlite3_step(_statement) != SQLITE_DONE) {
-      XLOG_ERROR(@"Failed writing to database at path \"%@\": %s", _databasePath, sqlite3_errmsg(_database));
-      _disableWrites = YES; // Write errors to database are typically not recoverable and we want to avoid entering an infinite logging loop
+    if (!sqlite3_get_autocommit(_database) && (sqlite3_exec(_database, "COMMIT TRANSACTION", NULL, NULL, NULL) != SQLITE_OK)) {
+      XLOG_ERROR(@"Failed committing to database at path \"%@\": %s", _databasePath, sqlite3_errmsg(_database));
+      sqlite3_exec(_database, "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+      _disableWrites = YES;
     }
-    sqlite3_reset(_statement);
-    sqlite3_clear_bindings(_statement);
   });
 }
 
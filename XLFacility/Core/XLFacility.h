@@ -54,6 +54,90 @@ extern NSString* const XLFacilityTag_CapturedStdErr;
 extern NSString* const XLFacilityTag_UncaughtExceptions;
 extern NSString* const XLFacilityTag_InitializedExceptions;
 
+/**
+ *  The XLLogSite structure describes a location in the source code messages
+ *  are logged from. The XLOG_* macros declare one as a static variable for each
+ *  expansion using XL_LOG_SITE_INITIALIZER() and pass it to XLFacility so that
+ *  work like cleaning up the tag is only done the first time.
+ *
+ *  The "enabled" field caches whether messages from the log site should be
+ *  logged according to the minimum log levels configured on XLFacility and is
+ *  what the macros check before doing anything else, along with "minLogLevel"
+ *  which records the value of XLMinLogLevel the cache was computed for.
+ *
+ *  @warning Only the "file", "function", "line", "level", "enabled" and
+ *  "minLogLevel" fields should be accessed directly and only for reading: the
+ *  other ones are managed by XLFacility.
+ */
+typedef struct XLLogSite {
+  const char* file;
+  const char* function;
+  int line;
+  XLLogLevel level;
+  int enabled;
+  XLLogLevel minLogLevel;
+  int state;
+  const void* _Nullable rawTag;
+  __unsafe_unretained NSString* _Nullable tag;
+  const void* _Nullable format;
+  const char* _Nullable formatString;
+  struct XLLogSite* _Nullable next;
+} XLLogSite;
+
+#define XL_LOG_SITE_INITIALIZER(__LEVEL__) \
+  { __FILE__, __FUNCTION__, __LINE__, __LEVEL__, 1, 0, 0, NULL, nil, NULL, NULL, NULL }
+
+#define XL_LOG_SITE_IS_ENABLED(__SITE__) \
+  (__atomic_load_n(&(__SITE__)->enabled, __ATOMIC_RELAXED) || (__atomic_load_n(&(__SITE__)->minLogLevel, __ATOMIC_RELAXED) != XLMinLogLevel))
+
+/**
+ *  Constants representing the types of values in XLMetadataItem.
+ */
+typedef NS_ENUM(unsigned char, XLMetadataType) {
+  kXLMetadataType_Int = 0,
+  kXLMetadataType_Double,
+  kXLMetadataType_Bool,
+  kXLMetadataType_String
+};
+
+/**
+ *  The XLMetadataItem structure describes a typed metadata key / value pair.
+ *  Logging metadata this way is much cheaper than with an NSDictionary as
+ *  values are only converted to strings or JSON if a logger needs them.
+ *
+ *  Use the XLM_*() macros to create items and XLOG_METADATA() to pass a list
+ *  of them to XLFacility.
+ *
+ *  @warning The key must be a string literal (or a C string that is never
+ *  freed) as XLFacility interns it using its address.
+ */
+typedef struct {
+  const char* key;
+  XLMetadataType type;
+  union {
+    long long intValue;
+    double doubleValue;
+    BOOL boolValue;
+    __unsafe_unretained NSString* _Nullable stringValue;
+  } value;
+} XLMetadataItem;
+
+/**
+ *  The XLMetadataList structure wraps an array of XLMetadataItem.
+ */
+typedef struct {
+  const XLMetadataItem* _Nullable items;
+  NSUInteger count;
+} XLMetadataList;
+
+#define XLM_INT(__KEY__, __VALUE__) ((XLMetadataItem){.key = (__KEY__), .type = kXLMetadataType_Int, .value.intValue = (long long)(__VALUE__)})
+#define XLM_DOUBLE(__KEY__, __VALUE__) ((XLMetadataItem){.key = (__KEY__), .type = kXLMetadataType_Double, .value.doubleValue = (double)(__VALUE__)})
+#define XLM_BOOL(__KEY__, __VALUE__) ((XLMetadataItem){.key = (__KEY__), .type = kXLMetadataType_Bool, .value.boolValue = (__VALUE__) ? YES : NO})
+#define XLM_STRING(__KEY__, __VALUE__) ((XLMetadataItem){.key = (__KEY__), .type = kXLMetadataType_String, .value.stringValue = (__VALUE__)})
+
+#define XLOG_METADATA(...) \
+  ((XLMetadataList){(const XLMetadataItem[]){__VA_ARGS__}, sizeof((const XLMetadataItem[]){__VA_ARGS__}) / sizeof(XLMetadataItem)})
+
 @class XLLogger;
 
 /**
@@ -79,6 +163,10 @@ extern NSString* const XLFacilityTag_InitializedExceptions;
  *  evaluates to non-zero at build time). This default value can also be overridden
  *  at run time by setting the environment variable "XLFacilityMinLogLevel" to the
  *  integer value for the level.
+ *
+ *  This value can be overridden for specific tags or log sites. In any case,
+ *  log messages below the lowest "minLogLevel" of all added loggers are
+ *  ignored, except at the ABORT level.
  */
 @property(nonatomic) XLLogLevel minLogLevel;
 
@@ -101,6 +189,66 @@ extern NSString* const XLFacilityTag_InitializedExceptions;
  */
 @property(nonatomic) XLLogLevel minInternalLogLevel;
 
+/**
+ *  Sets how long the thread logging a message at ERROR level or above waits at
+ *  most for the durable loggers which accepted it to have processed it (see
+ *  the "durable" property of XLLogger).
+ *
+ *  Pass 0.0 to wait indefinitely.
+ *
+ *  The default value is 5.0 seconds.
+ */
+@property(nonatomic) NSTimeInterval durableLoggersTimeout;
+
+/**
+ *  Sets whether messages logged using format strings are formatted lazily.
+ *
+ *  When enabled, logging a message only captures the format string and a
+ *  compact copy of its arguments: the message is formatted the first time a
+ *  logger accesses it on its own queue. Objects passed for "%@" are copied if
+ *  they conform to NSCopying (which is a simple retain for immutable ones) or
+ *  replaced by their description otherwise. Format strings that are not plain
+ *  ASCII or that use positional arguments or specifiers other than the
+ *  standard C ones and "%@" are always formatted immediately.
+ *
+ *  The default value is NO.
+ *
+ *  @warning With this option enabled, -description is called on copies of
+ *  "%@" arguments from arbitrary threads.
+ */
+@property(nonatomic) BOOL defersMessageFormatting;
+
+/**
+ *  Overrides "minLogLevel" for messages with a given tag, which for instance
+ *  allows to enable DEBUG log messages for a single subsystem.
+ *
+ *  Pass kXLMuteLogLevel to disable entirely messages with this tag.
+ */
+- (void)setMinLogLevel:(XLLogLevel)level forTag:(NSString*)tag;
+
+/**
+ *  Removes the override of "minLogLevel" for messages with a given tag.
+ */
+- (void)removeMinLogLevelForTag:(NSString*)tag;
+
+/**
+ *  Overrides "minLogLevel" for messages logged through the XLOG_* macros from
+ *  a given source file and line. Pass 0 for "line" to apply to the entire file.
+ *
+ *  "file" is matched against the trailing path components of the source file
+ *  paths e.g. "MyClass.m" or "Sources/MyClass.m". Overrides for log sites take
+ *  precedence over the ones for tags.
+ *
+ *  Pass kXLMuteLogLevel to disable entirely these log sites.
+ */
+- (void)setMinLogLevel:(XLLogLevel)level forLogSitesInFile:(NSString*)file line:(int)line;
+
+/**
+ *  Removes the override of "minLogLevel" for log sites in a given source file
+ *  and line.
+ */
+- (void)removeMinLogLevelForLogSitesInFile:(NSString*)file line:(int)line;
+
 /**
  *  Returns all currently added loggers.
  */
@@ -149,6 +297,13 @@ extern NSString* const XLFacilityTag_InitializedExceptions;
  */
 - (void)logMessage:(NSString*)message withTag:(nullable NSString*)tag level:(XLLogLevel)level metadata:(nullable NSDictionary<NSString*, id>*)metadata;
 
+/**
+ *  Logs a message with an optional tag, typed metadata and specific log level.
+ *
+ *  Pass nil for "tag" if you don't need one.
+ */
+- (void)logMessage:(NSString*)message withTag:(nullable NSString*)tag level:(XLLogLevel)level metadataList:(XLMetadataList)metadata;
+
 /**
  *  Logs a message as a format string with an optional tag and specific log
  *  level.
@@ -165,6 +320,26 @@ extern NSString* const XLFacilityTag_InitializedExceptions;
  */
 - (void)logMessageWithTag:(nullable NSString*)tag level:(XLLogLevel)level metadata:(nullable NSDictionary<NSString*, id>*)metadata format:(NSString*)format, ... NS_FORMAT_FUNCTION(4, 5);
 
+/**
+ *  Logs a message as a format string from a log site with an optional tag.
+ *
+ *  The log level is the one of the log site, and the tag is expected to be the
+ *  same for every call with the same log site as it is only processed once.
+ *
+ *  This method is used by the XLOG_* macros and you should not need to call it
+ *  directly.
+ */
+- (void)logMessageWithSite:(XLLogSite*)site tag:(nullable NSString*)tag format:(NSString*)format, ... NS_FORMAT_FUNCTION(3, 4);
+
+/**
+ *  Logs a message as a format string from a log site with an optional tag and
+ *  typed metadata.
+ *
+ *  This method is used by the XLOG_MESSAGE_WITH_METADATA() macro and you should
+ *  not need to call it directly.
+ */
+- (void)logMessageWithSite:(XLLogSite*)site tag:(nullable NSString*)tag metadataList:(XLMetadataList)metadata format:(NSString*)format, ... NS_FORMAT_FUNCTION(4, 5);
+
 /**
  *  Logs an exception with an optional tag and EXCEPTION log level.
  *
@@ -233,7 +408,10 @@ extern NSString* const XLFacilityTag_InitializedExceptions;
 @end
 
 /**
- *  Convenience global variable to access the global minimum log level.
+ *  Convenience global variable to access the global minimum log level i.e. the
+ *  "minLogLevel" property of XLFacility.
+ *
+ *  Modifying this variable directly is equivalent to setting the property.
  */
 extern XLLogLevel XLMinLogLevel;
 
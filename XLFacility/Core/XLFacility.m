@@ -30,6 +30,7 @@
 #endif
 
 #import <pthread.h>
+#import <sched.h>
 #import <objc/runtime.h>
 #import <execinfo.h>
 #import <netdb.h>
@@ -43,6 +44,32 @@
 #define kFileDescriptorCaptureBufferSize 1024
 #define kCapturedNSLogPrefix @"(NSLog) "
 
+#define kDefaultDurableLoggersTimeout 5.0
+
+#define kIngestRingCapacity 1024  // Must be a power of 2
+#define kIngestRetryDelay (1 * NSEC_PER_MSEC)
+
+#define kCTagCacheSize 64
+#define kCMessageBufferSize 1024
+
+// Cell of the lock-free multi-producers / single-consumer ring buffer (based on Dmitry Vyukov's bounded queue)
+typedef struct {
+  size_t sequence;
+  CFTypeRef record;
+} IngestCell;
+
+typedef NS_ENUM(int, LogSiteState) {
+  kLogSiteState_Unresolved = 0,
+  kLogSiteState_Resolving,
+  kLogSiteState_Resolved
+};
+
+typedef struct {
+  const char* pointer;
+  char* string;
+  __unsafe_unretained NSString* tag;  // Interned
+} CTagCacheEntry;
+
 typedef id (*ExceptionInitializerIMP)(id self, SEL cmd, NSString* name, NSString* reason, NSDictionary* userInfo);
 
 XLLogLevel XLMinLogLevel = 0;
@@ -62,16 +89,89 @@ static ExceptionInitializerIMP _originalExceptionInitializerIMP = NULL;
 static dispatch_source_t _stdOutCaptureSource = NULL;
 static dispatch_source_t _stdErrCaptureSource = NULL;
 static NSData* _newlineData = nil;
+static pthread_key_t _reentrancyKey;  // Set while loggers are processing log records
+static char _lockQueueKey;  // Set as specific on XLFacility's lock queue
+
+static pthread_mutex_t _internedTagsMutex = PTHREAD_MUTEX_INITIALIZER;
+static NSMutableSet* _internedTags = nil;
+
+static pthread_mutex_t _cTagCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static CTagCacheEntry _cTagCache[kCTagCacheSize];
+
+static pthread_mutex_t _logSitesMutex = PTHREAD_MUTEX_INITIALIZER;  // Protects all the variables below
+static XLLogSite* _logSites = NULL;  // Linked list of all resolved log sites
+static NSMutableDictionary<NSString*, NSNumber*>* _tagLevels = nil;
+static NSMutableArray* _logSiteOverrides = nil;
+static NSMutableArray* _retiredTagLevels = nil;
+static CFTypeRef _tagLevelsSnapshot = NULL;  // Immutable copy of _tagLevels or NULL if empty which can be read without holding the mutex
+static XLLogLevel _appliedMinLogLevel = 0;  // Value of XLMinLogLevel the log sites were last updated for
+static XLLogLevel _loggersMinLogLevel = kXLMinLogLevel;  // Can be read without holding the mutex
+
+static void _UpdateLogLevels(XLFacility* facility);
+static void _PublishTagLevels(void);
+
+@interface XLLogSiteOverride : NSObject
+@property(nonatomic, readonly) NSString* file;
+@property(nonatomic, readonly) int line;
+@property(nonatomic) XLLogLevel level;
+@end
+
+@implementation XLLogSiteOverride {
+  const char* _fileString;
+  size_t _fileLength;
+}
+
+- (id)initWithFile:(NSString*)file line:(int)line level:(XLLogLevel)level {
+  if ((self = [super init])) {
+    _file = [file copy];
+    _fileString = [_file UTF8String];
+    _fileLength = strlen(_fileString);
+    _line = line;
+    _level = level;
+  }
+  return self;
+}
+
+// The file must match entire trailing path components of the log site file
+- (BOOL)matchesLogSite:(XLLogSite*)site {
+  if (_line && (_line != site->line)) {
+    return NO;
+  }
+  size_t length = strlen(site->file);
+  if (length < _fileLength) {
+    return NO;
+  }
+  if ((length > _fileLength) && (site->file[length - _fileLength - 1] != '/')) {
+    return NO;
+  }
+  return strcmp(site->file + length - _fileLength, _fileString) == 0;
+}
+
+@end
+
+@interface XLFacility (Draining)
+- (BOOL)_drainRecords;
+- (void)_drainRecordsOrScheduleRetry;
+- (void)_performWithDrainedRecords:(dispatch_block_t)block;
+@end
 
 @implementation XLFacility {
   dispatch_queue_t _lockQueue;
-  dispatch_group_t _syncGroup;
-  NSMutableSet* _loggers;
-  pthread_key_t _pthreadKey;
+  CFTypeRef _loggers;  // Immutable NSArray snapshot that is atomically swapped on changes
+  unsigned long _loggersEpoch;  // Incremented every time a new snapshot is published
+  long _snapshotReaders[2];  // Readers of the current and previous epochs
+
+  IngestCell* _ingestRing;
+  size_t _ingestEnqueuePosition;  // Shared by all producers
+  size_t _ingestDequeuePosition;  // Only accessed on _lockQueue
+  long _ingestPendingCount;  // Number of records published in the ring but not dequeued yet
+  BOOL _ingestRetryScheduled;  // Only accessed on _lockQueue
+  int _inlineLoggerCount;  // Number of published loggers which log records on the calling thread
 }
 
 static void _ExitHandler() {
   @autoreleasepool {
+    [XLSharedFacility _flushRecords];
     [XLSharedFacility _closeAllLoggers];
   }
 }
@@ -92,6 +192,10 @@ static void _ExitHandler() {
       XLMinLogLevel = atoi(logLevel);
     }
 
+    pthread_key_create(&_reentrancyKey, NULL);
+
+    _internedTags = [[NSMutableSet alloc] initWithObjects:XLFacilityTag_Internal, XLFacilityTag_CapturedStdOut, XLFacilityTag_CapturedStdErr, XLFacilityTag_UncaughtExceptions, XLFacilityTag_InitializedExceptions, nil];  // Built-in tags are compared by pointer
+
     XLSharedFacility = [[XLFacility alloc] init];
 
     atexit(_ExitHandler);
@@ -108,31 +212,153 @@ static void _ExitHandler() {
     _minInternalLogLevel = XLMinLogLevel;
 
     _lockQueue = dispatch_queue_create(XL_DISPATCH_QUEUE_LABEL, DISPATCH_QUEUE_SERIAL);
-    _syncGroup = dispatch_group_create();
-    _loggers = [[NSMutableSet alloc] init];
-    pthread_key_create(&_pthreadKey, NULL);
+    dispatch_queue_set_specific(_lockQueue, &_lockQueueKey, &_lockQueueKey, NULL);
+    _durableLoggersTimeout = kDefaultDurableLoggersTimeout;
+    _loggers = CFBridgingRetain(@[]);
+
+    _ingestRing = calloc(kIngestRingCapacity, sizeof(IngestCell));
+    for (size_t i = 0; i < kIngestRingCapacity; ++i) {
+      _ingestRing[i].sequence = i;
+    }
 
     if (isatty(XLOriginalStdErr)) {
       [self addLogger:[XLStandardLogger sharedErrorLogger]];
+    } else {
+      _UpdateLogLevels(self);
     }
   }
   return self;
 }
 
+- (void)dealloc {
+  for (size_t i = 0; i < kIngestRingCapacity; ++i) {
+    if (_ingestRing[i].record) {
+      CFRelease(_ingestRing[i].record);
+    }
+  }
+  free(_ingestRing);
+  CFRelease(_loggers);
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+  dispatch_release(_lockQueue);
+#endif
+}
+
 - (XLLogLevel)minLogLevel {
   return XLMinLogLevel;
 }
 
 - (void)setMinLogLevel:(XLLogLevel)level {
   XLMinLogLevel = level;
+  _UpdateLogLevels(self);
+}
+
+- (void)loggerLogLevelsDidChange {
+  _UpdateLogLevels(self);
+}
+
+- (void)setMinLogLevel:(XLLogLevel)level forTag:(NSString*)tag {
+  pthread_mutex_lock(&_logSitesMutex);
+  if (_tagLevels == nil) {
+    _tagLevels = [[NSMutableDictionary alloc] init];
+  }
+  _tagLevels[tag] = @(level);
+  _PublishTagLevels();
+  pthread_mutex_unlock(&_logSitesMutex);
+  _UpdateLogLevels(self);
+}
+
+- (void)removeMinLogLevelForTag:(NSString*)tag {
+  pthread_mutex_lock(&_logSitesMutex);
+  [_tagLevels removeObjectForKey:tag];
+  _PublishTagLevels();
+  pthread_mutex_unlock(&_logSitesMutex);
+  _UpdateLogLevels(self);
+}
+
+- (void)setMinLogLevel:(XLLogLevel)level forLogSitesInFile:(NSString*)file line:(int)line {
+  pthread_mutex_lock(&_logSitesMutex);
+  if (_logSiteOverrides == nil) {
+    _logSiteOverrides = [[NSMutableArray alloc] init];
+  }
+  BOOL found = NO;
+  for (XLLogSiteOverride* override in _logSiteOverrides) {
+    if ((override.line == line) && [override.file isEqualToString:file]) {
+      override.level = level;
+      found = YES;
+      break;
+    }
+  }
+  if (!found) {
+    [_logSiteOverrides addObject:[[XLLogSiteOverride alloc] initWithFile:file line:line level:level]];
+  }
+  pthread_mutex_unlock(&_logSitesMutex);
+  _UpdateLogLevels(self);
+}
+
+- (void)removeMinLogLevelForLogSitesInFile:(NSString*)file line:(int)line {
+  pthread_mutex_lock(&_logSitesMutex);
+  NSIndexSet* indexes = [_logSiteOverrides indexesOfObjectsPassingTest:^BOOL(XLLogSiteOverride* override, NSUInteger index, BOOL* stop) {
+    return (override.line == line) && [override.file isEqualToString:file];
+  }];
+  [_logSiteOverrides removeObjectsAtIndexes:indexes];
+  pthread_mutex_unlock(&_logSitesMutex);
+  _UpdateLogLevels(self);
+}
+
+// Readers register in the counter of the current epoch for as long as they use the snapshot so writers know when the previous one can be safely released
+// Readers arriving after a new snapshot is published register in the other counter so writers only ever wait for a bounded number of them
+- (unsigned long)_beginReadingLoggers {
+  while (1) {
+    unsigned long epoch = __atomic_load_n(&_loggersEpoch, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&_snapshotReaders[epoch & 1], 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&_loggersEpoch, __ATOMIC_SEQ_CST) == epoch) {
+      return epoch;
+    }
+    __atomic_fetch_sub(&_snapshotReaders[epoch & 1], 1, __ATOMIC_SEQ_CST);  // A writer published a new snapshot in the meantime
+  }
+}
+
+- (void)_endReadingLoggers:(unsigned long)epoch {
+  __atomic_fetch_sub(&_snapshotReaders[epoch & 1], 1, __ATOMIC_SEQ_CST);
+}
+
+- (NSArray*)_loggersSnapshot {
+  unsigned long epoch = [self _beginReadingLoggers];
+  CFTypeRef loggers = __atomic_load_n(&_loggers, __ATOMIC_SEQ_CST);
+  CFRetain(loggers);
+  [self _endReadingLoggers:epoch];
+  return CFBridgingRelease(loggers);
+}
+
+// Must be called on _lockQueue
+- (void)_publishLoggers:(NSArray*)loggers {
+  int inlineLoggerCount = 0;
+  NSCountedSet* formatKeys = [[NSCountedSet alloc] init];
+  for (XLLogger* logger in loggers) {
+    if ([logger logsRecordsInline]) {
+      ++inlineLoggerCount;
+    }
+    NSString* formatKey = [logger writesFormattedRecords] ? [logger formatKey] : nil;
+    if (formatKey) {
+      [formatKeys addObject:formatKey];
+    }
+  }
+  for (XLLogger* logger in loggers) {  // Only memoize formatted records on loggers that can actually share them
+    NSString* formatKey = [logger writesFormattedRecords] ? [logger formatKey] : nil;
+    logger.sharesFormattedRecords = formatKey && ([formatKeys countForObject:formatKey] > 1);
+  }
+  __atomic_store_n(&_inlineLoggerCount, inlineLoggerCount, __ATOMIC_RELAXED);
+  CFTypeRef oldLoggers = __atomic_exchange_n(&_loggers, CFBridgingRetain(loggers), __ATOMIC_SEQ_CST);
+  unsigned long epoch = __atomic_fetch_add(&_loggersEpoch, 1, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&_snapshotReaders[epoch & 1], __ATOMIC_SEQ_CST)) {  // Wait for the grace period to be over i.e. no reader can still be using the previous snapshot
+    sched_yield();
+  }
+  CFRelease(oldLoggers);
+  _UpdateLogLevels(self);
 }
 
 - (NSSet*)loggers {
-  __block NSSet* loggers;
-  dispatch_sync(_lockQueue, ^{
-    loggers = [_loggers copy];
-  });
-  return loggers;
+  return [NSSet setWithArray:[self _loggersSnapshot]];
 }
 
 - (BOOL)addLogger:(XLLogger*)logger {
@@ -143,9 +369,12 @@ static void _ExitHandler() {
     });
 
     if (success) {
-      dispatch_sync(_lockQueue, ^{
-        [_loggers addObject:logger];
-      });
+      [self _performWithDrainedRecords:^{
+        NSArray* loggers = [self _loggersSnapshot];
+        if (![loggers containsObject:logger]) {
+          [self _publishLoggers:[loggers arrayByAddingObject:logger]];
+        }
+      }];
     }
   } else {
     XLOG_DEBUG_UNREACHABLE();
@@ -155,9 +384,11 @@ static void _ExitHandler() {
 
 - (void)removeLogger:(XLLogger*)logger {
   if (logger) {
-    dispatch_sync(_lockQueue, ^{
-      [_loggers removeObject:logger];
-    });
+    [self _performWithDrainedRecords:^{
+      NSMutableArray* loggers = [[self _loggersSnapshot] mutableCopy];
+      [loggers removeObject:logger];
+      [self _publishLoggers:[loggers copy]];
+    }];
 
     dispatch_sync(logger.serialQueue, ^{
       [logger performClose];
@@ -168,7 +399,7 @@ static void _ExitHandler() {
 }
 
 - (void)_closeAllLoggers {
-  for (XLLogger* logger in _loggers) {
+  for (XLLogger* logger in [self _loggersSnapshot]) {
     dispatch_sync(logger.serialQueue, ^{
       [logger performClose];
     });
@@ -176,10 +407,10 @@ static void _ExitHandler() {
 }
 
 - (void)removeAllLoggers {
-  dispatch_sync(_lockQueue, ^{
+  [self _performWithDrainedRecords:^{
     [self _closeAllLoggers];
-    [_loggers removeAllObjects];
-  });
+    [self _publishLoggers:@[]];
+  }];
 }
 
 @end
@@ -187,21 +418,49 @@ static void _ExitHandler() {
 @implementation XLFacility (Logging)
 
 // Must be called on _lockQueue
-- (void)_logRecord:(XLLogRecord*)record {
-  // Call each logger asynchronously on its own serial queue
-  for (XLLogger* logger in _loggers) {
-    if ([logger shouldLogRecord:record]) {
-      dispatch_group_async(_syncGroup, logger.serialQueue, ^{
-        pthread_setspecific(_pthreadKey, &XLSharedFacility);
-        [logger performLogRecord:record];
-        pthread_setspecific(_pthreadKey, NULL);
-      });
+// Use plain functions instead of blocks to avoid allocating a block for every log record and logger
+static void _DrainLogger(void* context) {
+  @autoreleasepool {
+    XLLogger* logger = (__bridge_transfer XLLogger*)context;
+    pthread_setspecific(_reentrancyKey, &XLSharedFacility);
+    [logger performDrain];
+    pthread_setspecific(_reentrancyKey, NULL);
+  }
+}
+
+// Returns a dispatch group to wait on for durable loggers to have processed the log record if at ERROR level or above
+- (dispatch_group_t)_logRecord:(XLLogRecord*)record {
+  dispatch_group_t fence = NULL;
+  BOOL urgent = (record.level >= kXLLogLevel_Error);
+
+  // Register the loggers sharing formatted data before any of them can receive the log record so the last one to format it frees the data
+  NSArray* loggers = [self _loggersSnapshot];
+  __unsafe_unretained XLLogger* acceptingLoggers[MAX(loggers.count, (NSUInteger)1)];
+  NSUInteger acceptingCount = 0;
+  for (XLLogger* logger in loggers) {
+    if (![logger logsRecordsInline] && [logger shouldLogRecord:record]) {
+      NSString* formatKey = logger.sharesFormattedRecords ? [logger formatKey] : nil;
+      if (formatKey) {
+        [record addFormattedDataConsumerForKey:(__bridge const void*)formatKey];
+      }
+      acceptingLoggers[acceptingCount++] = logger;
     }
   }
 
-  // If the log record is at ERROR level or above, block XLFacility entirely until all loggers are done
-  if (record.level >= kXLLogLevel_Error) {
-    dispatch_group_wait(_syncGroup, DISPATCH_TIME_FOREVER);
+  // Call each logger asynchronously on its own serial queue
+  for (NSUInteger i = 0; i < acceptingCount; ++i) {
+    XLLogger* logger = acceptingLoggers[i];
+    XLLoggerDrain drain = [logger enqueueRecord:record];  // Loggers accumulate records and deliver them in batches if they support it
+    if (urgent && logger.durable) {  // Always schedule an extra drain for durable loggers as the log record might otherwise be delivered by a drain scheduled earlier
+      if (fence == NULL) {
+        fence = dispatch_group_create();
+      }
+      dispatch_group_async_f(fence, logger.serialQueue, (__bridge_retained void*)logger, _DrainLogger);
+    } else if (drain == kXLLoggerDrain_Delayed) {
+      dispatch_after_f(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(logger.maxBatchLatency * (NSTimeInterval)NSEC_PER_SEC)), logger.serialQueue, (__bridge_retained void*)logger, _DrainLogger);
+    } else if (drain == kXLLoggerDrain_Immediate) {
+      dispatch_async_f(logger.serialQueue, (__bridge_retained void*)logger, _DrainLogger);
+    }
   }
 
   // If the log record is at ABORT level, close all loggers and kill the process
@@ -209,9 +468,117 @@ static void _ExitHandler() {
     [self _closeAllLoggers];
     abort();
   }
+
+  return fence;
+}
+
+static void _DrainRecords(void* context) {
+  @autoreleasepool {
+    XLFacility* facility = (__bridge_transfer XLFacility*)context;
+    [facility _drainRecordsOrScheduleRetry];
+  }
+}
+
+static void _RetryDrainRecords(void* context) {
+  @autoreleasepool {
+    XLFacility* facility = (__bridge_transfer XLFacility*)context;
+    facility->_ingestRetryScheduled = NO;
+    [facility _drainRecordsOrScheduleRetry];
+  }
+}
+
+// Can be called from any thread - Returns NO if the ring is full
+- (BOOL)_enqueueRecord:(XLLogRecord*)record {
+  IngestCell* cell;
+  size_t position = __atomic_load_n(&_ingestEnqueuePosition, __ATOMIC_RELAXED);
+  while (1) {
+    cell = &_ingestRing[position & (kIngestRingCapacity - 1)];
+    intptr_t difference = (intptr_t)__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (intptr_t)position;
+    if (difference == 0) {
+      if (__atomic_compare_exchange_n(&_ingestEnqueuePosition, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (difference < 0) {
+      return NO;
+    } else {
+      position = __atomic_load_n(&_ingestEnqueuePosition, __ATOMIC_RELAXED);
+    }
+  }
+  cell->record = CFBridgingRetain(record);
+  __atomic_store_n(&cell->sequence, position + 1, __ATOMIC_RELEASE);
+
+  // Only the producer that makes the ring non-empty needs to wake up the consumer
+  if (__atomic_fetch_add(&_ingestPendingCount, 1, __ATOMIC_ACQ_REL) == 0) {
+    dispatch_async_f(_lockQueue, (__bridge_retained void*)self, _DrainRecords);
+  }
+  return YES;
 }
 
-- (void)_logMessage:(NSString*)message withTag:(NSString*)tag level:(XLLogLevel)level callstack:(NSArray*)callstack metadata:(NSDictionary<NSString*, NSString*>*)metadata {
+// Must be called on _lockQueue - Returns NO if it stopped at a cell reserved by a producer that has not published its record yet
+- (BOOL)_drainRecords {
+  while (1) {
+    long count = __atomic_load_n(&_ingestPendingCount, __ATOMIC_ACQUIRE);
+    if (count == 0) {
+      return YES;
+    }
+    long dequeued = 0;
+    while (dequeued < count) {
+      IngestCell* cell = &_ingestRing[_ingestDequeuePosition & (kIngestRingCapacity - 1)];
+      if (__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) != _ingestDequeuePosition + 1) {
+        break;
+      }
+      XLLogRecord* record = CFBridgingRelease(cell->record);
+      cell->record = NULL;
+      __atomic_store_n(&cell->sequence, _ingestDequeuePosition + kIngestRingCapacity, __ATOMIC_RELEASE);
+      _ingestDequeuePosition += 1;
+      [self _logRecord:record];
+      ++dequeued;
+    }
+    if (__atomic_sub_fetch(&_ingestPendingCount, dequeued, __ATOMIC_ACQ_REL) == 0) {
+      return YES;
+    }
+    if (dequeued < count) {
+      return NO;
+    }
+  }
+}
+
+// Must be called on _lockQueue - Rather than waiting for a producer that has not published its record yet and stalling every logger, a single new drain is scheduled shortly after
+// Producers only schedule a drain when the ring becomes non-empty so the retry must be scheduled here
+- (void)_drainRecordsOrScheduleRetry {
+  if (![self _drainRecords] && !_ingestRetryScheduled) {
+    _ingestRetryScheduled = YES;
+    dispatch_after_f(dispatch_time(DISPATCH_TIME_NOW, kIngestRetryDelay), _lockQueue, (__bridge_retained void*)self, _RetryDrainRecords);
+  }
+}
+
+// Executes the block on _lockQueue once all records published in the ring have been delivered to loggers
+// The calling thread waits outside of _lockQueue while a producer finishes publishing its record so other loggers are not stalled
+- (void)_performWithDrainedRecords:(dispatch_block_t)block {
+  __block BOOL drained = NO;
+  while (1) {
+    dispatch_sync(_lockQueue, ^{
+      drained = [self _drainRecords];
+      if (drained) {
+        block();
+      }
+    });
+    if (drained) {
+      break;
+    }
+    sched_yield();
+  }
+}
+
+- (void)_flushRecords {
+  if (!pthread_getspecific(_reentrancyKey) && !dispatch_get_specific(&_lockQueueKey)) {  // Never block if called from a logger or XLFacility itself
+    [self _performWithDrainedRecords:^{
+      ;
+    }];
+  }
+}
+
+- (void)_logMessage:(NSString*)message withTag:(NSString*)tag level:(XLLogLevel)level callstack:(NSArray*)callstack metadata:(NSDictionary<NSString*, id>*)metadata metadataList:(const XLMetadataList*)metadataList {
   if (message == nil) {
     XLOG_DEBUG_UNREACHABLE();
     return;
@@ -233,23 +600,73 @@ static void _ExitHandler() {
   }
 #endif
 
-  // Save current absolute time
-  CFAbsoluteTime time = CFAbsoluteTimeGetCurrent();
+  // Save current monotonic time (conversion to absolute time is cheap and never goes backward)
+  uint64_t time = XLGetMonotonicTime();
 
-  // Capture current callstack if necessary (using the same format as -[NSException callStackSymbols])
+  // Capture current callstack if necessary (only raw frames as symbolication is deferred until needed)
+  void* backtraceFrames[128];
+  int frameCount = 0;
   if ((level >= _minCaptureCallstackLevel) && !callstack) {
-    void* backtraceFrames[128];
-    int frameCount = backtrace(backtraceFrames, sizeof(backtraceFrames) / sizeof(void*));
-    char** frameStrings = backtrace_symbols(backtraceFrames, frameCount);
-    if (frameStrings) {
-      callstack = [[NSMutableArray alloc] init];
-      for (int i = 0; i < frameCount; ++i) {
-        [(NSMutableArray*)callstack addObject:(id)[NSString stringWithUTF8String:frameStrings[i]]];
+    frameCount = backtrace(backtraceFrames, sizeof(backtraceFrames) / sizeof(void*));
+  }
+
+  // Create the log record and send to loggers through the ingest ring which preserves ordering per thread
+  int metadataCount = metadataList ? (int)metadataList->count : (int)metadata.count;
+  XLLogRecord* record = [[XLLogRecord allocWithInlineFrameCapacity:frameCount metadataCapacity:metadataCount] initWithMonotonicTime:time tag:tag level:level message:message metadata:nil callstack:callstack];
+  if (frameCount > 0) {
+    [record setCallstackFrames:backtraceFrames count:frameCount];
+  }
+  if (metadataList) {
+    [record setMetadataList:metadataList];
+  } else if (metadata) {
+    [record setMetadataDictionary:metadata];
+  }
+
+  // Loggers like XLFlightRecorderLogger receive the log record right away on the calling thread so it survives a crash happening immediately after
+  // Loggers with a blocking overflow policy apply backpressure here on the logging thread and never on _lockQueue
+  BOOL reentrant = (pthread_getspecific(_reentrancyKey) != NULL) || (dispatch_get_specific(&_lockQueueKey) != NULL);
+  if (!reentrant) {
+    for (XLLogger* logger in [self _loggersSnapshot]) {
+      if (![logger logsRecordsInline]) {
+        [logger waitForRoomInMailboxForRecord:record];
+      }
+    }
+  }
+
+  // The snapshot is read for the whole iteration so removed loggers cannot be closed while still receiving the log record
+  if (__atomic_load_n(&_inlineLoggerCount, __ATOMIC_RELAXED)) {
+    unsigned long epoch = [self _beginReadingLoggers];
+    for (XLLogger* logger in (__bridge NSArray*)__atomic_load_n(&_loggers, __ATOMIC_SEQ_CST)) {
+      if ([logger logsRecordsInline] && [logger shouldLogRecord:record]) {
+        [logger logRecord:record];
       }
-      free(frameStrings);  // No need to free individual strings
+    }
+    [self _endReadingLoggers:epoch];
+  }
+  if (reentrant) {  // Avoid deadlock in in case of reentrancy on the same thread by never blocking
+    if (![self _enqueueRecord:record]) {
+      dispatch_async(_lockQueue, ^{
+        [self _drainRecordsOrScheduleRetry];
+        [self _logRecord:record];
+      });
+    }
+  } else if ((level >= kXLLogLevel_Error) || ![self _enqueueRecord:record]) {  // Log records at ERROR level or above as well as overflows from the ring are processed synchronously after all pending ones
+    __block dispatch_group_t fence = NULL;
+    [self _performWithDrainedRecords:^{
+      fence = [self _logRecord:record];
+    }];
+
+    // If the log record is at ERROR level or above, wait for the durable loggers that accepted it without blocking XLFacility
+    if (fence) {
+      dispatch_group_wait(fence, _durableLoggersTimeout > 0.0 ? dispatch_time(DISPATCH_TIME_NOW, (int64_t)(_durableLoggersTimeout * (NSTimeInterval)NSEC_PER_SEC)) : DISPATCH_TIME_FOREVER);
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+      dispatch_release(fence);
+#endif
     }
   }
+}
 
+static NSString* _CleanTag(NSString* tag) {
 #if DEBUG
   // Clean up the tag if it looks like it was generated from the __FILE__ preprocessor macro
   if (tag.length && ([tag characterAtIndex:0] == '/')) {
@@ -266,63 +683,251 @@ static void _ExitHandler() {
     tag = [NSString stringWithUTF8String:tagPtr];  // Strip the common prefix between the tag and __FILE__ for this very file
   }
 #endif
+  return tag;
+}
 
-  // Create the log record and send to loggers
-  XLLogRecord* record = [[XLLogRecord alloc] initWithAbsoluteTime:time tag:tag level:level message:message metadata:metadata callstack:callstack];
-  if (pthread_getspecific(_pthreadKey)) {  // Avoid deadlock in in case of reentrancy on the same thread by exceptionally making the logging asynchronous
-    dispatch_async(_lockQueue, ^{
-      [self _logRecord:record];
-    });
-  } else {
-    dispatch_sync(_lockQueue, ^{
-      [self _logRecord:record];
-    });
+// Interned tags are never released so log sites can safely keep unretained references to them
+static NSString* _InternTag(NSString* tag) {
+  if (tag == nil) {
+    return nil;
+  }
+  pthread_mutex_lock(&_internedTagsMutex);
+  NSString* internedTag = [_internedTags member:tag];
+  if (internedTag == nil) {
+    internedTag = [tag copy];
+    [_internedTags addObject:internedTag];
+  }
+  pthread_mutex_unlock(&_internedTagsMutex);
+  return internedTag;
+}
+
+// Tags from C code are typically string literals so they are looked up by address first then verified by content in case the memory was reused
+static NSString* _InternCTag(const char* tag) {
+  if (tag == NULL) {
+    return nil;
+  }
+  CTagCacheEntry* entry = &_cTagCache[((uintptr_t)tag >> 3) % kCTagCacheSize];
+  NSString* internedTag = nil;
+  pthread_mutex_lock(&_cTagCacheMutex);
+  if ((entry->pointer == tag) && !strcmp(entry->string, tag)) {
+    internedTag = entry->tag;
   }
+  pthread_mutex_unlock(&_cTagCacheMutex);
+  if (internedTag == nil) {
+    NSString* string = [NSString stringWithUTF8String:tag] ?: [NSString stringWithCString:tag encoding:NSMacOSRomanStringEncoding];
+    internedTag = _InternTag(_CleanTag(string));
+    char* copy = strdup(tag);
+    pthread_mutex_lock(&_cTagCacheMutex);
+    free(entry->string);
+    entry->pointer = tag;
+    entry->string = copy;
+    entry->tag = internedTag;
+    pthread_mutex_unlock(&_cTagCacheMutex);
+  }
+  return internedTag;
 }
 
-static void _MetadataApplier(const void* key, const void* value, void* context) {
-  NSMutableDictionary<NSString*, NSString*>* output = (__bridge NSMutableDictionary<NSString*, NSString*>*)context;
-  [output setObject:[(__bridge NSString*)value description] forKey:(__bridge NSString*)key];
+// Must be called with _logSitesMutex held
+static void _UpdateLogSite(XLLogSite* site) {
+  XLLogSiteOverride* bestOverride = nil;
+  for (XLLogSiteOverride* override in _logSiteOverrides) {
+    if ([override matchesLogSite:site] && (!bestOverride || (override.line && !bestOverride.line))) {  // Overrides for specific lines take precedence
+      bestOverride = override;
+    }
+  }
+  XLLogLevel minLevel = _appliedMinLogLevel;
+  if (bestOverride) {
+    minLevel = bestOverride.level;
+  } else if (site->tag && _tagLevels.count) {
+    NSNumber* level = _tagLevels[site->tag];
+    if (level) {
+      minLevel = level.intValue;
+    }
+  }
+  minLevel = MAX(minLevel, MIN(_loggersMinLogLevel, kXLLogLevel_Abort));  // No point in logging below the level of all loggers but never prevent ABORT from aborting
+  __atomic_store_n(&site->enabled, site->level >= minLevel, __ATOMIC_RELAXED);
+  __atomic_store_n(&site->minLogLevel, _appliedMinLogLevel, __ATOMIC_RELAXED);
 }
 
-static NSDictionary<NSString*, NSString*>* _SanitizeMetadata(NSDictionary<NSString*, id>* input) {
-  NSMutableDictionary<NSString*, NSString*>* output = nil;
-  if (input.count) {
-    output = [[NSMutableDictionary alloc] initWithCapacity:input.count];
-    CFDictionaryApplyFunction((CFDictionaryRef)input, _MetadataApplier, (__bridge void*)output);
+// Recomputes the minimum log level across all loggers then folds it along with XLMinLogLevel into log sites
+static void _UpdateLogLevels(XLFacility* facility) {
+  pthread_mutex_lock(&_logSitesMutex);
+  XLLogLevel loggersMinLogLevel = kXLMuteLogLevel;
+  for (XLLogger* logger in [facility _loggersSnapshot]) {
+    loggersMinLogLevel = MIN(loggersMinLogLevel, logger.minLogLevel);
+  }
+  __atomic_store_n(&_loggersMinLogLevel, loggersMinLogLevel, __ATOMIC_RELAXED);
+  __atomic_store_n(&_appliedMinLogLevel, XLMinLogLevel, __ATOMIC_RELAXED);
+  for (XLLogSite* site = _logSites; site; site = site->next) {
+    _UpdateLogSite(site);
+  }
+  pthread_mutex_unlock(&_logSitesMutex);
+}
+
+// Must be called with _logSitesMutex held
+// Readers use snapshots without any synchronization so previous ones are never released (tag levels are expected to rarely change)
+static void _PublishTagLevels(void) {
+  CFTypeRef snapshot = _tagLevels.count ? CFBridgingRetain([_tagLevels copy]) : NULL;
+  CFTypeRef oldSnapshot = __atomic_exchange_n(&_tagLevelsSnapshot, snapshot, __ATOMIC_ACQ_REL);
+  if (oldSnapshot) {
+    if (_retiredTagLevels == nil) {
+      _retiredTagLevels = [[NSMutableArray alloc] init];
+    }
+    [_retiredTagLevels addObject:CFBridgingRelease(oldSnapshot)];
+  }
+}
+
+// No point in logging below the level of all loggers but never prevent ABORT from aborting
+static inline XLLogLevel _EffectiveMinLogLevel(void) {
+  return MAX(XLMinLogLevel, MIN(__atomic_load_n(&_loggersMinLogLevel, __ATOMIC_RELAXED), kXLLogLevel_Abort));
+}
+
+static BOOL _IsLevelEnabledForTag(XLLogLevel level, NSString* tag) {
+  CFTypeRef tagLevels = tag ? __atomic_load_n(&_tagLevelsSnapshot, __ATOMIC_ACQUIRE) : NULL;
+  if (tagLevels) {
+    NSNumber* minLevel = ((__bridge NSDictionary*)tagLevels)[tag];
+    if (minLevel) {
+      return level >= MAX(minLevel.intValue, MIN(__atomic_load_n(&_loggersMinLogLevel, __ATOMIC_RELAXED), kXLLogLevel_Abort));
+    }
+  }
+  return level >= _EffectiveMinLogLevel();
+}
+
+// Only the thread winning the race resolves the log site while the other ones simply proceed without it
+static void _ResolveLogSite(XLLogSite* site, NSString* tag, NSString* format) {
+  int state = kLogSiteState_Unresolved;
+  if (__atomic_compare_exchange_n(&site->state, &state, kLogSiteState_Resolving, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    site->rawTag = tag ? CFBridgingRetain(tag) : NULL;  // Log sites are static variables so these are never released
+    site->tag = _InternTag(_CleanTag(tag));
+    site->format = CFBridgingRetain(format);
+    site->formatString = [XLDeferredMessage capturableStringForFormat:format];
+    pthread_mutex_lock(&_logSitesMutex);
+    site->next = _logSites;
+    _logSites = site;
+    _UpdateLogSite(site);
+    pthread_mutex_unlock(&_logSitesMutex);
+    __atomic_store_n(&site->state, kLogSiteState_Resolved, __ATOMIC_RELEASE);
   }
-  return output;
 }
 
 - (void)logMessage:(NSString*)message withTag:(NSString*)tag level:(XLLogLevel)level {
-  if (level >= XLMinLogLevel) {
-    [self _logMessage:[message copy] withTag:tag level:level callstack:nil metadata:nil];
+  if (_IsLevelEnabledForTag(level, tag)) {
+    [self _logMessage:[message copy] withTag:_CleanTag(tag) level:level callstack:nil metadata:nil metadataList:NULL];
   }
 }
 
 - (void)logMessage:(NSString*)message withTag:(NSString*)tag level:(XLLogLevel)level metadata:(NSDictionary<NSString*, id>*)metadata {
-  if (level >= XLMinLogLevel) {
-    [self _logMessage:[message copy] withTag:tag level:level callstack:nil metadata:_SanitizeMetadata(metadata)];
+  if (_IsLevelEnabledForTag(level, tag)) {
+    [self _logMessage:[message copy] withTag:_CleanTag(tag) level:level callstack:nil metadata:metadata metadataList:NULL];
   }
 }
 
+- (void)logMessage:(NSString*)message withTag:(NSString*)tag level:(XLLogLevel)level metadataList:(XLMetadataList)metadata {
+  if (_IsLevelEnabledForTag(level, tag)) {
+    [self _logMessage:[message copy] withTag:_CleanTag(tag) level:level callstack:nil metadata:nil metadataList:&metadata];
+  }
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wformat-nonliteral"
+
+// Formats directly into UTF-8 unless the format string uses Obj-C objects
+- (void)logCMessageWithTag:(const char*)tag level:(XLLogLevel)level format:(const char*)format arguments:(va_list)arguments {
+  if ((level < _EffectiveMinLogLevel()) && !__atomic_load_n(&_tagLevelsSnapshot, __ATOMIC_RELAXED)) {
+    return;
+  }
+  NSString* internedTag = _InternCTag(tag);
+  if (!_IsLevelEnabledForTag(level, internedTag)) {
+    return;
+  }
+  NSString* message;
+  if (strstr(format, "%@")) {
+    message = [[NSString alloc] initWithFormat:(id)[NSString stringWithUTF8String:format] arguments:arguments];
+  } else {
+    char storage[kCMessageBufferSize];
+    va_list copy;
+    va_copy(copy, arguments);
+    int length = vsnprintf(storage, sizeof(storage), format, copy);
+    va_end(copy);
+    if (length < 0) {
+      length = 0;
+    }
+    char* bytes = storage;
+    if ((size_t)length >= sizeof(storage)) {
+      bytes = malloc((size_t)length + 1);
+      vsnprintf(bytes, (size_t)length + 1, format, arguments);
+    }
+    message = [XLDeferredMessage messageWithUTF8Bytes:bytes length:(size_t)length];
+    if (bytes != storage) {
+      free(bytes);
+    }
+  }
+  [self _logMessage:message withTag:internedTag level:level callstack:nil metadata:nil metadataList:NULL];
+}
+
+#pragma clang diagnostic pop
+
 - (void)logMessageWithTag:(NSString*)tag level:(XLLogLevel)level format:(NSString*)format, ... {
-  if (level >= XLMinLogLevel) {
+  if (_IsLevelEnabledForTag(level, tag)) {
     va_list arguments;
     va_start(arguments, format);
-    NSString* message = [[NSString alloc] initWithFormat:format arguments:arguments];
+    NSString* message = _defersMessageFormatting ? [XLDeferredMessage messageWithFormat:format arguments:arguments] : nil;
+    if (message == nil) {
+      message = [[NSString alloc] initWithFormat:format arguments:arguments];
+    }
     va_end(arguments);
-    [self _logMessage:message withTag:tag level:level callstack:nil metadata:nil];
+    [self _logMessage:message withTag:_CleanTag(tag) level:level callstack:nil metadata:nil metadataList:NULL];
+  }
+}
+
+- (void)_logMessageWithSite:(XLLogSite*)site tag:(NSString*)tag metadataList:(const XLMetadataList*)metadataList format:(NSString*)format arguments:(va_list)arguments {
+  if (XLMinLogLevel != __atomic_load_n(&_appliedMinLogLevel, __ATOMIC_RELAXED)) {  // XLMinLogLevel was modified directly instead of through the property
+    _UpdateLogLevels(self);
+  }
+  if (__atomic_load_n(&site->state, __ATOMIC_ACQUIRE) == kLogSiteState_Unresolved) {
+    _ResolveLogSite(site, tag, format);
+  }
+  BOOL resolved = (__atomic_load_n(&site->state, __ATOMIC_ACQUIRE) == kLogSiteState_Resolved);
+  if (resolved ? __atomic_load_n(&site->enabled, __ATOMIC_RELAXED) : (site->level >= _EffectiveMinLogLevel())) {  // The first call to a log site always ends up here even if disabled
+    NSString* message = nil;
+    if (_defersMessageFormatting) {
+      const char* formatString = resolved && ((__bridge const void*)format == site->format) ? site->formatString : [XLDeferredMessage capturableStringForFormat:format];
+      if (formatString) {
+        message = [XLDeferredMessage messageWithFormat:format capturableString:formatString arguments:arguments];
+      }
+    }
+    if (message == nil) {
+      message = [[NSString alloc] initWithFormat:format arguments:arguments];
+    }
+    NSString* siteTag = resolved && ((__bridge const void*)tag == site->rawTag) ? site->tag : _CleanTag(tag);
+    [self _logMessage:message withTag:siteTag level:site->level callstack:nil metadata:nil metadataList:metadataList];
   }
 }
 
+- (void)logMessageWithSite:(XLLogSite*)site tag:(NSString*)tag format:(NSString*)format, ... {
+  va_list arguments;
+  va_start(arguments, format);
+  [self _logMessageWithSite:site tag:tag metadataList:NULL format:format arguments:arguments];
+  va_end(arguments);
+}
+
+- (void)logMessageWithSite:(XLLogSite*)site tag:(NSString*)tag metadataList:(XLMetadataList)metadata format:(NSString*)format, ... {
+  va_list arguments;
+  va_start(arguments, format);
+  [self _logMessageWithSite:site tag:tag metadataList:&metadata format:format arguments:arguments];
+  va_end(arguments);
+}
+
 - (void)logMessageWithTag:(NSString*)tag level:(XLLogLevel)level metadata:(NSDictionary<NSString*, id>*)metadata format:(NSString*)format, ... {
-  if (level >= XLMinLogLevel) {
+  if (_IsLevelEnabledForTag(level, tag)) {
     va_list arguments;
     va_start(arguments, format);
-    NSString* message = [[NSString alloc] initWithFormat:format arguments:arguments];
+    NSString* message = _defersMessageFormatting ? [XLDeferredMessage messageWithFormat:format arguments:arguments] : nil;
+    if (message == nil) {
+      message = [[NSString alloc] initWithFormat:format arguments:arguments];
+    }
     va_end(arguments);
-    [self _logMessage:message withTag:tag level:level callstack:nil metadata:_SanitizeMetadata(metadata)];
+    [self _logMessage:message withTag:_CleanTag(tag) level:level callstack:nil metadata:metadata metadataList:NULL];
   }
 }
 
@@ -331,9 +936,9 @@ static NSDictionary<NSString*, NSString*>* _SanitizeMetadata(NSDictionary<NSStri
 }
 
 - (void)logException:(NSException*)exception withTag:(NSString*)tag metadata:(NSDictionary<NSString*, id>*)metadata {
-  if (kXLLogLevel_Exception >= XLMinLogLevel) {
+  if (_IsLevelEnabledForTag(kXLLogLevel_Exception, tag)) {
     NSString* message = [NSString stringWithFormat:@"%@ %@", exception.name, exception.reason];
-    [self _logMessage:message withTag:tag level:kXLLogLevel_Exception callstack:exception.callStackSymbols metadata:_SanitizeMetadata(metadata)];
+    [self _logMessage:message withTag:_CleanTag(tag) level:kXLLogLevel_Exception callstack:exception.callStackSymbols metadata:metadata metadataList:NULL];
   }
 }
 
@@ -34,6 +34,23 @@
  *  See XLFacilityMacros.h for more information.
  */
 
+/**
+ *  Logs a message from a C format string and an optional tag: this is the
+ *  function used by the macros below.
+ *
+ *  The format string is not checked with a printf format attribute since "%@"
+ *  is also supported to log Obj-C objects.
+ */
+extern void XLLogCMessage(const char* tag, int level, const char* format, ...);
+
+/**
+ *  The macros below conflict with the ones in XLFacilityMacros.h so they are
+ *  skipped if it was imported first, which allows Obj-C files to only import
+ *  the declaration of XLLogCMessage() above.
+ */
+
+#ifndef XLOG_VERBOSE
+
 #ifndef XLOG_TAG
 #if DEBUG
 #define XLOG_STRINGIFY(x) #x
@@ -95,6 +112,7 @@
 #endif
 
 extern int XLMinLogLevel;
-extern void XLLogCMessage(const char* tag, int level, const char* format, ...);
+
+#endif  // XLOG_VERBOSE
 
 #endif  // __XLFacilityCMacros__
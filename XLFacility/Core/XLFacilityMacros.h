@@ -78,38 +78,54 @@
 #endif
 #endif
 
+/**
+ *  Each expansion of the logging macros below declares a static XLLogSite
+ *  describing where the message is logged from. Disabled log sites only cost
+ *  a single load and branch.
+ *
+ *  DEBUG messages are only compiled in if the preprocessor constant "DEBUG"
+ *  evaluates to non-zero at build time unless "XLOG_COMPILE_DEBUG" is defined
+ *  to a non-zero value *before* including XLFacilityMacros.h.
+ *
+ *  Typed metadata can be attached to a message with XLOG_MESSAGE_WITH_METADATA()
+ *  e.g. `XLOG_MESSAGE_WITH_METADATA(kXLLogLevel_Info, XLOG_METADATA(XLM_INT("status", status),
+ *  XLM_STRING("path", path)), @"Request completed in %.3fs", duration)`.
+ */
+
+#ifndef XLOG_COMPILE_DEBUG
 #if DEBUG
-#define XLOG_DEBUG(...)                                                                                                               \
-  do {                                                                                                                                \
-    if (XLMinLogLevel <= kXLLogLevel_Debug) [XLSharedFacility logMessageWithTag:XLOG_TAG level:kXLLogLevel_Debug format:__VA_ARGS__]; \
-  } while (0)
+#define XLOG_COMPILE_DEBUG 1
 #else
-#define XLOG_DEBUG(...)
+#define XLOG_COMPILE_DEBUG 0
 #endif
-#define XLOG_VERBOSE(...)                                                                                                                 \
-  do {                                                                                                                                    \
-    if (XLMinLogLevel <= kXLLogLevel_Verbose) [XLSharedFacility logMessageWithTag:XLOG_TAG level:kXLLogLevel_Verbose format:__VA_ARGS__]; \
-  } while (0)
-#define XLOG_INFO(...)                                                                                                              \
-  do {                                                                                                                              \
-    if (XLMinLogLevel <= kXLLogLevel_Info) [XLSharedFacility logMessageWithTag:XLOG_TAG level:kXLLogLevel_Info format:__VA_ARGS__]; \
-  } while (0)
-#define XLOG_WARNING(...)                                                                                                                 \
-  do {                                                                                                                                    \
-    if (XLMinLogLevel <= kXLLogLevel_Warning) [XLSharedFacility logMessageWithTag:XLOG_TAG level:kXLLogLevel_Warning format:__VA_ARGS__]; \
+#endif
+
+#define XLOG_MESSAGE(__LEVEL__, ...)                                                                                            \
+  do {                                                                                                                          \
+    static XLLogSite __xlogSite = XL_LOG_SITE_INITIALIZER(__LEVEL__);                                                           \
+    if (XL_LOG_SITE_IS_ENABLED(&__xlogSite)) [XLSharedFacility logMessageWithSite:&__xlogSite tag:XLOG_TAG format:__VA_ARGS__]; \
   } while (0)
-#define XLOG_ERROR(...)                                                                                                               \
-  do {                                                                                                                                \
-    if (XLMinLogLevel <= kXLLogLevel_Error) [XLSharedFacility logMessageWithTag:XLOG_TAG level:kXLLogLevel_Error format:__VA_ARGS__]; \
+
+#define XLOG_MESSAGE_WITH_METADATA(__LEVEL__, __METADATA__, ...)                                                                                          \
+  do {                                                                                                                                                    \
+    static XLLogSite __xlogSite = XL_LOG_SITE_INITIALIZER(__LEVEL__);                                                                                     \
+    if (XL_LOG_SITE_IS_ENABLED(&__xlogSite)) [XLSharedFacility logMessageWithSite:&__xlogSite tag:XLOG_TAG metadataList:__METADATA__ format:__VA_ARGS__]; \
   } while (0)
+
+#if XLOG_COMPILE_DEBUG
+#define XLOG_DEBUG(...) XLOG_MESSAGE(kXLLogLevel_Debug, __VA_ARGS__)
+#else
+#define XLOG_DEBUG(...)
+#endif
+#define XLOG_VERBOSE(...) XLOG_MESSAGE(kXLLogLevel_Verbose, __VA_ARGS__)
+#define XLOG_INFO(...) XLOG_MESSAGE(kXLLogLevel_Info, __VA_ARGS__)
+#define XLOG_WARNING(...) XLOG_MESSAGE(kXLLogLevel_Warning, __VA_ARGS__)
+#define XLOG_ERROR(...) XLOG_MESSAGE(kXLLogLevel_Error, __VA_ARGS__)
 #define XLOG_EXCEPTION(__EXCEPTION__)                                                                           \
   do {                                                                                                          \
     if (XLMinLogLevel <= kXLLogLevel_Exception) [XLSharedFacility logException:__EXCEPTION__ withTag:XLOG_TAG]; \
   } while (0)
-#define XLOG_ABORT(...)                                                                                                               \
-  do {                                                                                                                                \
-    if (XLMinLogLevel <= kXLLogLevel_Abort) [XLSharedFacility logMessageWithTag:XLOG_TAG level:kXLLogLevel_Abort format:__VA_ARGS__]; \
-  } while (0)
+#define XLOG_ABORT(...) XLOG_MESSAGE(kXLLogLevel_Abort, __VA_ARGS__)
 
 /**
  *  These other macros let you easily check conditions inside your code and
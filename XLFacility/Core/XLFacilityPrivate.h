@@ -46,11 +46,46 @@ NS_ASSUME_NONNULL_BEGIN
 
 #define XL_GLOBAL_DISPATCH_QUEUE dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0)
 
+#define kXLWordLowBytes ((uint64_t)0x0101010101010101ULL)  // For scanning 8 bytes at a time
+#define kXLWordHighBits ((uint64_t)0x8080808080808080ULL)
+
+static inline uint64_t XLWordHasByteLessThan(uint64_t word, unsigned char byte) {  // Only valid for byte values up to 128
+  return (word - (uint64_t)byte * kXLWordLowBytes) & ~word & kXLWordHighBits;
+}
+
+static inline uint64_t XLWordHasByte(uint64_t word, unsigned char byte) {
+  return XLWordHasByteLessThan(word ^ ((uint64_t)byte * kXLWordLowBytes), 1);
+}
+
 extern int XLOriginalStdOut;
 extern int XLOriginalStdErr;
 
 extern NSString* XLPaddedStringFromLogLevelName(XLLogLevel level);
 
+extern void XLFlightRecorderWriteSignalSafe(int level, const char* _Nullable tag, const char* message, size_t length);  // Writes to all opened XLFlightRecorderLogger instances
+
+typedef struct {
+  unsigned char* _Nullable bytes;
+  size_t length;
+  size_t capacity;
+  BOOL onHeap;
+} XLByteBuffer;
+
+extern void XLByteBufferInit(XLByteBuffer* buffer, void* _Nullable storage, size_t capacity);  // Optional storage is typically on the stack and used until it overflows
+extern void XLByteBufferReserve(XLByteBuffer* buffer, size_t length);  // Ensures there are at least "length" bytes available past the current length
+extern void XLByteBufferAppend(XLByteBuffer* buffer, const void* bytes, size_t length);
+extern void XLByteBufferDestroy(XLByteBuffer* buffer);
+extern void XLByteBufferAppendJSONBytes(XLByteBuffer* buffer, const void* bytes, size_t length);  // Appends a quoted and escaped JSON string from UTF-8 bytes
+extern void XLByteBufferAppendJSONString(XLByteBuffer* buffer, const char* string);  // Same as above for a NUL-terminated UTF-8 string
+
+@interface XLDeferredMessage : NSString
++ (nullable const char*)capturableStringForFormat:(NSString*)format;  // Returns NULL if the format string cannot be captured
++ (nullable NSString*)messageWithFormat:(NSString*)format arguments:(va_list)arguments;  // Returns nil if the format string cannot be captured
++ (NSString*)messageWithFormat:(NSString*)format capturableString:(const char*)formatString arguments:(va_list)arguments;
++ (NSString*)messageWithUTF8Bytes:(const char*)bytes length:(size_t)length;  // Bytes are only converted to a string when needed
+- (NSUInteger)estimatedSize;
+@end
+
 @interface XLLogRecord ()
 - (id)initWithAbsoluteTime:(CFAbsoluteTime)absoluteTime
                        tag:(nullable NSString*)tag
@@ -61,21 +96,59 @@ extern NSString* XLPaddedStringFromLogLevelName(XLLogLevel level);
           capturedThreadID:(int)capturedThreadID
         capturedQueueLabel:(nullable NSString*)capturedQueueLabel
                  callstack:(nullable NSArray*)callstack;
-- (id)initWithAbsoluteTime:(CFAbsoluteTime)absoluteTime
-                       tag:(nullable NSString*)tag
-                     level:(XLLogLevel)level
-                   message:(NSString*)message
-                  metadata:(nullable NSDictionary<NSString*, NSString*>*)metadata
-                 callstack:(nullable NSArray*)callstack;
+- (id)initWithMonotonicTime:(uint64_t)monotonicTime
+                        tag:(nullable NSString*)tag
+                      level:(XLLogLevel)level
+                    message:(NSString*)message
+                   metadata:(nullable NSDictionary<NSString*, NSString*>*)metadata
+                  callstack:(nullable NSArray*)callstack;
++ (instancetype)allocWithInlineFrameCapacity:(int)frameCapacity metadataCapacity:(int)metadataCapacity;  // Reserves inline storage for callstack frames and metadata items within the same allocation
+- (void)setCallstackFrames:(void* const*)frames count:(int)count;  // Frames are symbolicated on first access to "callstack"
+- (void)setMetadataList:(const XLMetadataList*)list;  // Values are converted to strings on first access to "metadata"
+- (void)setMetadataDictionary:(NSDictionary<NSString*, id>*)dictionary;
+- (BOOL)appendMetadataAsJSONToBuffer:(XLByteBuffer*)buffer;  // Returns NO if there is no metadata
+- (void)addFormattedDataConsumerForKey:(const void*)key;  // Must be called for each logger sharing the key before the log record is delivered to any of them
+- (void)removeFormattedDataConsumerForKey:(const void*)key;  // For registered loggers which drop the log record without formatting it
+- (void)appendFormattedDataForKey:(const void*)key toBuffer:(XLByteBuffer*)buffer usingBlock:(void (^)(void))block;  // Thread-safe, the block must append the formatted log record to the buffer and is called if the data is not available
+- (NSUInteger)estimatedSize;  // Approximate memory footprint used for backpressure accounting
+@end
+
+@interface XLFacility ()
+- (void)loggerLogLevelsDidChange;
+@end
+
+@interface XLFacility (Ingest)
+- (void)_flushRecords;  // Synchronously delivers to loggers all log records pending in the ingest ring (no-op if called from a logger or XLFacility)
 @end
 
+@interface XLFacility (CLogging)
+- (void)logCMessageWithTag:(nullable const char*)tag level:(XLLogLevel)level format:(const char*)format arguments:(va_list)arguments;  // Used by XLLogCMessage()
+@end
+
+typedef NS_ENUM(int, XLLoggerDrain) {
+  kXLLoggerDrain_None = 0,
+  kXLLoggerDrain_Delayed,
+  kXLLoggerDrain_Immediate
+};
+
 @interface XLLogger ()
 @property(nonatomic, readonly) dispatch_queue_t serialQueue;
 @property(nonatomic, getter=isReady) BOOL ready;
 - (BOOL)shouldLogRecord:(XLLogRecord*)record;
+@property(nonatomic) BOOL sharesFormattedRecords;  // Set by XLFacility if other loggers have the same format key
+- (BOOL)logsRecordsInline;  // If YES, -logRecord: is called directly on the thread logging the record instead of the serial queue and must be thread-safe
+- (BOOL)writesFormattedRecords;  // If YES, the logger formats records through -appendFormattedRecord:toBuffer: and can reuse bytes formatted by other loggers
+- (nullable NSString*)formatKey;  // Interned string identifying the formatting configuration or nil if formatting methods are overridden
 - (BOOL)performOpen;
-- (void)performLogRecord:(XLLogRecord*)record;
+- (void)waitForRoomInMailboxForRecord:(XLLogRecord*)record;  // Applies kXLLoggerOverflowPolicy_Block on the logging thread
+- (XLLoggerDrain)enqueueRecord:(XLLogRecord*)record;  // Returns how the caller must schedule -performDrain if at all
+- (void)performDrain;
 - (void)performClose;
 @end
 
+@interface XLLogger (ByteFormatting)
+- (void)appendFormattedRecord:(XLLogRecord*)record toBuffer:(XLByteBuffer*)buffer;  // Appends the same UTF-8 bytes as -formatRecord: without going through an intermediary NSString unless -formatRecord: is overridden
+- (XLByteBuffer*)reusableFormatBuffer;  // Returns an empty buffer owned by the logger which must only be used on the serial queue
+@end
+
 NS_ASSUME_NONNULL_END
@@ -32,8 +32,9 @@ NS_ASSUME_NONNULL_BEGIN
 /**
  *  The XLFileLogger class writes logs records to a file.
  *
- *  @warning XLFileLogger does not perform any buffering when writing to the
- *  file i.e. log records are written to disk immediately.
+ *  @warning By default XLFileLogger does not perform any buffering when writing
+ *  to the file i.e. log records are written to disk immediately (see the
+ *  "bufferSize" property).
  */
 @interface XLFileLogger : XLLogger
 
@@ -49,6 +50,81 @@ NS_ASSUME_NONNULL_BEGIN
  */
 @property(nonatomic, readonly) int fileDescriptor;
 
+/**
+ *  Sets the size in bytes of the in-memory buffer used to coalesce writes to
+ *  the file.
+ *
+ *  Formatted log records are accumulated in the buffer and written at once
+ *  when the buffer would overflow, when "flushInterval" has elapsed, when a
+ *  log record at "flushLevel" or above is received, when a fence block is
+ *  executed or when the logger is closed.
+ *
+ *  The default value is 0 i.e. no buffering.
+ *
+ *  @warning Buffered log records are written when the process exits normally
+ *  as XLFacility closes all loggers at exit, but they are lost if the process
+ *  crashes or terminates with _exit().
+ */
+@property(nonatomic) NSUInteger bufferSize;
+
+/**
+ *  Sets the maximum delay in seconds before buffered log records are written
+ *  to the file or 0.0 to only write them when another condition is met.
+ *
+ *  The default value is 1.0.
+ */
+@property(nonatomic) NSTimeInterval flushInterval;
+
+/**
+ *  Sets the minimum log level at which buffered log records are immediately
+ *  written to the file along with the log record received.
+ *
+ *  The default value is ERROR.
+ */
+@property(nonatomic) XLLogLevel flushLevel;
+
+/**
+ *  Sets the size in bytes above which the log file is rotated i.e. renamed
+ *  with a UTC timestamp suffix (e.g. "app.log.20150101-120000") and replaced
+ *  by a new empty file.
+ *
+ *  This only applies to loggers initialized with a file path. If renaming the
+ *  log file fails, rotation is disabled until the logger is reopened.
+ *
+ *  The default value is 0 i.e. no size-based rotation.
+ */
+@property(nonatomic) unsigned long long maximumFileSize;
+
+/**
+ *  Sets the interval in seconds at which the log file is rotated. Rotations
+ *  happen on multiples of the interval since 1970 UTC so for instance an
+ *  interval of 86400 rotates the file every day at midnight UTC.
+ *
+ *  This only applies to loggers initialized with a file path.
+ *
+ *  The default value is 0.0 i.e. no time-based rotation.
+ */
+@property(nonatomic) NSTimeInterval rotationInterval;
+
+/**
+ *  Sets the maximum number of rotated log files to keep next to the log file,
+ *  the oldest ones being deleted first.
+ *
+ *  The default value is 0 i.e. no limit.
+ */
+@property(nonatomic) NSUInteger maximumRotatedFiles;
+
+/**
+ *  Sets if rotated log files are compressed with gzip.
+ *
+ *  Compression and deletion of old rotated log files happen on a low-priority
+ *  background queue so that rotation never delays the logging of records.
+ *  Closing the logger waits for them to complete.
+ *
+ *  The default value is YES.
+ */
+@property(nonatomic) BOOL compressesRotatedFiles;
+
 /**
  *  This method is a designated initializer for the class.
  *
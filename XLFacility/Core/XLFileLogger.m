@@ -29,6 +29,10 @@
 #error XLFacility requires ARC
 #endif
 
+#import <sys/stat.h>
+#import <sys/uio.h>
+#import <zlib.h>
+
 #import "XLFileLogger.h"
 #import "XLFunctions.h"
 #import "XLFacilityPrivate.h"
@@ -37,6 +41,12 @@
   int _fd;
   BOOL _close;
   BOOL _append;
+  XLByteBuffer _pendingBuffer;
+  BOOL _flushScheduled;
+  unsigned long long _fileSize;
+  CFAbsoluteTime _nextRotationTime;
+  BOOL _rotationFailed;
+  dispatch_queue_t _rotationQueue;
 }
 
 - (id)init {
@@ -48,6 +58,13 @@
   if ((self = [super init])) {
     _filePath = [path copy];
     _append = append;
+    _compressesRotatedFiles = YES;
+    _rotationQueue = dispatch_queue_create(XL_DISPATCH_QUEUE_LABEL, DISPATCH_QUEUE_SERIAL);
+    dispatch_set_target_queue(_rotationQueue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0));
+    _flushInterval = 1.0;
+    _flushLevel = kXLLogLevel_Error;
+    XLByteBufferInit(&_pendingBuffer, NULL, 0);
+    self.durable = YES;
   }
   return self;
 }
@@ -57,21 +74,60 @@
   if ((self = [super init])) {
     _fileDescriptor = fd;
     _close = close;
+    _compressesRotatedFiles = YES;
+    _flushInterval = 1.0;
+    _flushLevel = kXLLogLevel_Error;
+    XLByteBufferInit(&_pendingBuffer, NULL, 0);
+    self.durable = YES;
   }
   return self;
 }
 
 - (void)dealloc {
+  XLByteBufferDestroy(&_pendingBuffer);
   if (_close) {
     close(_fileDescriptor);
   }
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+  if (_rotationQueue) {
+    dispatch_release(_rotationQueue);
+  }
+#endif
+}
+
+- (void)_updateNextRotationTime {
+  if (_rotationInterval > 0.0) {
+    CFAbsoluteTime interval = _rotationInterval;
+    CFAbsoluteTime time = CFAbsoluteTimeGetCurrent() + kCFAbsoluteTimeIntervalSince1970;
+    _nextRotationTime = (floor(time / interval) + 1.0) * interval - kCFAbsoluteTimeIntervalSince1970;
+  } else {
+    _nextRotationTime = 0.0;
+  }
+}
+
+- (void)setRotationInterval:(NSTimeInterval)interval {
+  _rotationInterval = interval;
+  if (_fd >= 0) {
+    [self _updateNextRotationTime];
+  }
+}
+
+- (BOOL)_openFileWithFlags:(int)flags {
+  _fd = open([_filePath fileSystemRepresentation], O_CREAT | O_WRONLY | flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (_fd < 0) {
+    XLOG_ERROR(@"Failed opening log file at \"%@\": %s", _filePath, strerror(errno));
+    return NO;
+  }
+  struct stat info;
+  _fileSize = fstat(_fd, &info) == 0 ? (unsigned long long)info.st_size : 0;
+  [self _updateNextRotationTime];
+  return YES;
 }
 
 - (BOOL)open {
   if (_filePath) {
-    _fd = open([_filePath fileSystemRepresentation], O_CREAT | (_append ? 0 : O_TRUNC) | O_WRONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-    if (_fd < 0) {
-      XLOG_ERROR(@"Failed opening log file at \"%@\": %s", _filePath, strerror(errno));
+    _rotationFailed = NO;
+    if (![self _openFileWithFlags:(_append ? O_APPEND : O_TRUNC)]) {
       return NO;
     }
   } else {
@@ -80,11 +136,153 @@
   return YES;
 }
 
-// We are using write() which is not buffered contrary to fwrite() so no flushing is needed
-- (void)logRecord:(XLLogRecord*)record {
+- (BOOL)writesFormattedRecords {
+  return YES;
+}
+
+static BOOL _CompressFile(NSString* path, NSString* compressedPath) {
+  BOOL success = NO;
+  int fd = open([path fileSystemRepresentation], O_RDONLY);
+  if (fd >= 0) {
+    gzFile file = gzopen([compressedPath fileSystemRepresentation], "wb");
+    if (file) {
+      char buffer[32 * 1024];
+      ssize_t length;
+      success = YES;
+      while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+        if (gzwrite(file, buffer, (unsigned int)length) != length) {
+          success = NO;
+          break;
+        }
+      }
+      if (length < 0) {
+        success = NO;
+      }
+      if (gzclose(file) != Z_OK) {
+        success = NO;
+      }
+      if (success) {
+        unlink([path fileSystemRepresentation]);
+      } else {
+        unlink([compressedPath fileSystemRepresentation]);
+      }
+    }
+    close(fd);
+  }
+  return success;
+}
+
+// Rotated files are named after the log file followed by a timestamp and an optional counter so sorting their names numerically sorts them chronologically
+static void _DeleteOldestRotatedFiles(NSString* filePath, NSUInteger maximumCount) {
+  NSString* directoryPath = [filePath stringByDeletingLastPathComponent];
+  NSString* prefix = [[filePath lastPathComponent] stringByAppendingString:@"."];
+  NSMutableArray* names = [[NSMutableArray alloc] init];
+  for (NSString* name in [[NSFileManager defaultManager] contentsOfDirectoryAtPath:directoryPath error:NULL]) {
+    if ([name hasPrefix:prefix] && (name.length > prefix.length) && isdigit([name characterAtIndex:prefix.length])) {
+      [names addObject:name];
+    }
+  }
+  if (names.count > maximumCount) {
+    [names sortUsingComparator:^NSComparisonResult(NSString* name1, NSString* name2) {
+      if ([name1.pathExtension isEqualToString:@"gz"]) {
+        name1 = [name1 stringByDeletingPathExtension];
+      }
+      if ([name2.pathExtension isEqualToString:@"gz"]) {
+        name2 = [name2 stringByDeletingPathExtension];
+      }
+      return [name1 compare:name2 options:NSNumericSearch];
+    }];
+    for (NSUInteger i = 0, count = names.count - maximumCount; i < count; ++i) {
+      unlink([[directoryPath stringByAppendingPathComponent:names[i]] fileSystemRepresentation]);
+    }
+  }
+}
+
+- (NSString*)_rotatedFilePath {
+  char timestamp[32];
+  time_t now = time(NULL);
+  struct tm date;
+  strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S", gmtime_r(&now, &date));  // Use UTC like the rotation interval
+  NSString* path = [NSString stringWithFormat:@"%@.%s", _filePath, timestamp];
+  NSFileManager* manager = [NSFileManager defaultManager];
+  for (int i = 1; [manager fileExistsAtPath:path] || [manager fileExistsAtPath:[path stringByAppendingPathExtension:@"gz"]]; ++i) {  // Handle multiple rotations within the same second
+    path = [NSString stringWithFormat:@"%@.%s-%i", _filePath, timestamp, i];
+  }
+  return path;
+}
+
+// Only renaming the file and opening a new one happen on the serial queue
+// If renaming fails, rotation is disabled until the logger is reopened instead of being retried for every record
+- (void)_rotateFile {
+  NSString* rotatedPath = [self _rotatedFilePath];
+  close(_fd);
+  _fd = -1;
+  BOOL renamed = (rename([_filePath fileSystemRepresentation], [rotatedPath fileSystemRepresentation]) == 0);
+  if (!renamed) {
+    XLOG_ERROR(@"Failed rotating log file at \"%@\" (rotation is disabled until the logger is reopened): %s", _filePath, strerror(errno));
+    _rotationFailed = YES;
+  }
+  [self _openFileWithFlags:(renamed ? O_TRUNC : O_APPEND)];
+
+  if (renamed) {
+    NSString* filePath = _filePath;
+    BOOL compress = _compressesRotatedFiles;
+    NSUInteger maximumCount = _maximumRotatedFiles;
+    dispatch_async(_rotationQueue, ^{
+      @autoreleasepool {
+        if (compress && !_CompressFile(rotatedPath, [rotatedPath stringByAppendingPathExtension:@"gz"])) {
+          XLOG_ERROR(@"Failed compressing rotated log file at \"%@\"", rotatedPath);
+        }
+        if (maximumCount) {
+          _DeleteOldestRotatedFiles(filePath, maximumCount);
+        }
+      }
+    });
+  }
+}
+
+// Writes the pending bytes followed by the new ones with a single system call unless the write is short
+- (void)_writePendingBytesAndBytes:(const void*)bytes length:(size_t)length {
   if (_fd >= 0) {
-    NSData* data = XLConvertNSStringToUTF8String([self formatRecord:record]);
-    if (write(_fd, data.bytes, data.length) < 0) {
+    struct iovec vectors[2];
+    int count = 0;
+    if (_pendingBuffer.length) {
+      vectors[count].iov_base = _pendingBuffer.bytes;
+      vectors[count].iov_len = _pendingBuffer.length;
+      ++count;
+    }
+    if (length) {
+      vectors[count].iov_base = (void*)bytes;
+      vectors[count].iov_len = length;
+      ++count;
+    }
+    size_t totalLength = _pendingBuffer.length + length;
+    if (_filePath && _fileSize && !_rotationFailed && (((_maximumFileSize > 0) && (_fileSize + totalLength > _maximumFileSize)) || ((_nextRotationTime > 0.0) && (CFAbsoluteTimeGetCurrent() >= _nextRotationTime)))) {
+      [self _rotateFile];
+    }
+    struct iovec* vector = vectors;
+    ssize_t result = 0;
+    while (count && (_fd >= 0)) {
+      result = writev(_fd, vector, count);
+      if (result < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        break;
+      }
+      _fileSize += (unsigned long long)result;
+      size_t written = (size_t)result;  // Skip what was written and retry with the remaining bytes
+      while (count && (written >= vector->iov_len)) {
+        written -= vector->iov_len;
+        ++vector;
+        --count;
+      }
+      if (count) {
+        vector->iov_base = (unsigned char*)vector->iov_base + written;
+        vector->iov_len -= written;
+      }
+    }
+    if (result < 0) {
       if (_filePath) {
         XLOG_ERROR(@"Failed writing to log file at \"%@\": %s", _filePath, strerror(errno));
         close(_fd);
@@ -94,11 +292,63 @@
       _fd = -1;
     }
   }
+  _pendingBuffer.length = 0;
+}
+
+- (void)_writeBytes:(const void*)bytes length:(size_t)length flush:(BOOL)flush {
+  if (_bufferSize && !flush && (_pendingBuffer.length + length <= _bufferSize)) {
+    XLByteBufferAppend(&_pendingBuffer, bytes, length);
+    if (!_flushScheduled && (_flushInterval > 0.0)) {
+      _flushScheduled = YES;
+      dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(_flushInterval * (NSTimeInterval)NSEC_PER_SEC)), self.serialQueue, ^{
+        _flushScheduled = NO;
+        [self flush];
+      });
+    }
+  } else {
+    [self _writePendingBytesAndBytes:bytes length:length];
+  }
+}
+
+// Records are formatted straight into UTF-8 in a buffer reused across calls
+- (void)logRecord:(XLLogRecord*)record {
+  if (_fd >= 0) {
+    XLByteBuffer* buffer = [self reusableFormatBuffer];
+    [self appendFormattedRecord:record toBuffer:buffer];
+    [self _writeBytes:buffer->bytes length:buffer->length flush:(record.level >= _flushLevel)];
+  }
+}
+
+// Coalesce the entire batch into a single write
+- (void)logRecords:(NSArray<XLLogRecord*>*)records {
+  if (_fd >= 0) {
+    XLByteBuffer* buffer = [self reusableFormatBuffer];
+    BOOL flush = NO;
+    for (XLLogRecord* record in records) {
+      @autoreleasepool {
+        [self appendFormattedRecord:record toBuffer:buffer];
+      }
+      if (record.level >= _flushLevel) {
+        flush = YES;
+      }
+    }
+    [self _writeBytes:buffer->bytes length:buffer->length flush:flush];
+  }
+}
+
+- (void)flush {
+  if (_pendingBuffer.length) {
+    [self _writePendingBytesAndBytes:NULL length:0];
+  }
 }
 
 - (void)close {
+  [self flush];
   if (_filePath) {
     close(_fd);
+    dispatch_sync(_rotationQueue, ^{
+      ;  // Wait for rotated files to be compressed and old ones to be deleted
+    });
   }
   _fd = -1;
 }
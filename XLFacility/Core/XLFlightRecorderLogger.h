@@ -0,0 +1,102 @@
+/*
+ Copyright (c) 2014, Pierre-Olivier Latour
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * The name of Pierre-Olivier Latour may not be used to endorse
+ or promote products derived from this software without specific
+ prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL PIERRE-OLIVIER LATOUR BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "XLLogger.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  The XLFlightRecorderLogger class writes log records as fixed-size binary
+ *  entries into a ring stored in a memory-mapped file, so that the most recent
+ *  log records remain on disk even if the process is killed or crashes.
+ *
+ *  Contrary to other loggers, log records are written directly on the thread
+ *  logging them, before XLFacility returns, and writing one is simply a copy
+ *  into the mapped memory without any system call. Messages and tags longer
+ *  than what fits in an entry are truncated.
+ *
+ *  Since the log record is written right away, messages whose formatting is
+ *  normally deferred to the loggers (see "defersMessageFormatting" on
+ *  XLFacility) are formatted on the logging thread as soon as one of these
+ *  loggers is added, which trades some logging latency for crash resilience.
+ *
+ *  If the file already exists and was created with the same entry size and
+ *  count, new log records are appended to the existing ones, which is what
+ *  allows to recover the log records from a previous run.
+ *
+ *  Messages logged with XLLogSignalSafeMessage() and XLLogSignalSafeCallstack()
+ *  are only written to the first 4 opened XLFlightRecorderLogger instances.
+ *  Additional ones log a warning when opened and only receive regular log
+ *  records.
+ *
+ *  @warning The file is only guaranteed to be written to disk by the OS if the
+ *  process exits or crashes, not if the whole system goes down.
+ */
+@interface XLFlightRecorderLogger : XLLogger
+
+/**
+ *  Returns the file path as specified when the logger was initialized.
+ */
+@property(nonatomic, readonly) NSString* filePath;
+
+/**
+ *  Returns the number of entries in the ring.
+ */
+@property(nonatomic, readonly) NSUInteger recordCount;
+
+/**
+ *  Returns the size of each entry in the ring in bytes.
+ */
+@property(nonatomic, readonly) NSUInteger recordSize;
+
+/**
+ *  This method is the designated initializer for the class.
+ *
+ *  The file size is roughly "count" x "size" bytes and "size" must be at least
+ *  64 bytes.
+ *
+ *  @warning The file is not created or opened until the logger is opened.
+ */
+- (instancetype)initWithFilePath:(NSString*)path recordCount:(NSUInteger)count recordSize:(NSUInteger)size;
+
+/**
+ *  Calls -initWithFilePath:recordCount:recordSize: with a ring of 16,384
+ *  entries of 256 bytes i.e. 4 MB.
+ */
+- (instancetype)initWithFilePath:(NSString*)path;
+
+/**
+ *  Reads back the log records from a file written by XLFlightRecorderLogger
+ *  from the oldest to the newest.
+ *
+ *  Returns NO if the file cannot be read or is not a valid flight recorder file.
+ */
++ (BOOL)enumerateRecordsInFileAtPath:(NSString*)path usingBlock:(void (^)(XLLogRecord* record, BOOL* stop))block;
+
+@end
+
+NS_ASSUME_NONNULL_END
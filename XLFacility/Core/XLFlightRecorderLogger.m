@@ -0,0 +1,318 @@
+/*
+ Copyright (c) 2014, Pierre-Olivier Latour
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * The name of Pierre-Olivier Latour may not be used to endorse
+ or promote products derived from this software without specific
+ prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL PIERRE-OLIVIER LATOUR BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !__has_feature(objc_arc)
+#error XLFacility requires ARC
+#endif
+
+#import <sys/mman.h>
+#import <sys/stat.h>
+#import <time.h>
+#import <pthread.h>
+#import <sched.h>
+
+#import "XLFlightRecorderLogger.h"
+#import "XLFacilityPrivate.h"
+
+#define kFileMagic "XLFLTREC"
+#define kFileVersion 1
+#define kFileHeaderSize 64
+
+#define kDefaultRecordCount (16 * 1024)
+#define kDefaultRecordSize 256
+#define kMinRecordSize 64
+#define kMaxRecordSize (64 * 1024)
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize;
+  uint64_t recordCount;
+  uint64_t nextSequence;  // Atomically incremented by writers
+} FileHeader;
+
+// Followed by the tag then the message as UTF-8
+typedef struct {
+  uint64_t sequence;  // 1-based and only set once the entry is complete
+  double absoluteTime;
+  int32_t level;
+  int32_t threadID;
+  int32_t capturedErrno;
+  uint16_t tagLength;
+  uint16_t messageLength;
+} EntryHeader;
+
+typedef struct {
+  uint64_t sequence;
+  uint64_t index;
+} EntryReference;
+
+#define kMaxRegisteredRings 4
+
+static void* _registeredRings[kMaxRegisteredRings];  // Mappings of opened loggers for XLFlightRecorderWriteSignalSafe()
+static long _signalSafeWriters = 0;  // Number of XLFlightRecorderWriteSignalSafe() calls in progress
+
+// Returns NO if the maximum number of registered rings has been reached
+static BOOL _RegisterRing(void* mapping) {
+  for (int i = 0; i < kMaxRegisteredRings; ++i) {
+    void* empty = NULL;
+    if (__atomic_compare_exchange_n(&_registeredRings[i], &empty, mapping, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      return YES;
+    }
+  }
+  return NO;
+}
+
+static void _UnregisterRing(void* mapping) {
+  for (int i = 0; i < kMaxRegisteredRings; ++i) {
+    void* expected = mapping;
+    if (__atomic_compare_exchange_n(&_registeredRings[i], &expected, NULL, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+}
+
+// Returns the claimed entry invalidated until _PublishEntry() is called
+static EntryHeader* _ClaimEntry(unsigned char* mapping, uint64_t* sequence) {
+  FileHeader* header = (FileHeader*)mapping;
+  *sequence = __atomic_add_fetch(&header->nextSequence, 1, __ATOMIC_RELAXED);
+  EntryHeader* entry = (EntryHeader*)(mapping + kFileHeaderSize + ((*sequence - 1) % header->recordCount) * header->recordSize);
+  __atomic_store_n(&entry->sequence, 0, __ATOMIC_RELAXED);  // Invalidate the entry while it's being overwritten
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  return entry;
+}
+
+static void _PublishEntry(EntryHeader* entry, uint64_t sequence) {
+  __atomic_store_n(&entry->sequence, sequence, __ATOMIC_RELEASE);
+}
+
+// Only uses async-signal-safe calls hence the time with a 1 second resolution and no thread ID
+void XLFlightRecorderWriteSignalSafe(int level, const char* tag, const char* message, size_t length) {
+  time_t now = time(NULL);
+  size_t tagLength = tag ? strlen(tag) : 0;
+  __atomic_fetch_add(&_signalSafeWriters, 1, __ATOMIC_SEQ_CST);  // Prevents mappings loaded below from being unmapped
+  for (int i = 0; i < kMaxRegisteredRings; ++i) {
+    unsigned char* mapping = __atomic_load_n(&_registeredRings[i], __ATOMIC_SEQ_CST);
+    if (mapping) {
+      size_t available = ((FileHeader*)mapping)->recordSize - sizeof(EntryHeader);
+      uint64_t sequence;
+      EntryHeader* entry = _ClaimEntry(mapping, &sequence);
+      entry->absoluteTime = (double)now - kCFAbsoluteTimeIntervalSince1970;
+      entry->level = level;
+      entry->threadID = 0;
+      entry->capturedErrno = 0;
+      entry->tagLength = (uint16_t)MIN(tagLength, available / 2);
+      entry->messageLength = (uint16_t)MIN(length, available - entry->tagLength);
+      memcpy(entry + 1, tag, entry->tagLength);
+      memcpy((unsigned char*)(entry + 1) + entry->tagLength, message, entry->messageLength);
+      _PublishEntry(entry, sequence);
+    }
+  }
+  __atomic_fetch_sub(&_signalSafeWriters, 1, __ATOMIC_SEQ_CST);
+}
+
+// CFStringGetBytes() never splits a character so the result is always valid UTF-8 even if truncated
+static size_t _CopyUTF8Bytes(NSString* string, unsigned char* buffer, size_t size) {
+  CFIndex length = 0;
+  if (string) {
+    CFStringGetBytes((CFStringRef)string, CFRangeMake(0, CFStringGetLength((CFStringRef)string)), kCFStringEncodingUTF8, '?', false, buffer, (CFIndex)size, &length);
+  }
+  return (size_t)length;
+}
+
+static NSString* _StringFromUTF8Bytes(const unsigned char* bytes, size_t length) {
+  return [[NSString alloc] initWithBytes:bytes length:length encoding:NSUTF8StringEncoding] ?: [[NSString alloc] initWithBytes:bytes length:length encoding:NSMacOSRomanStringEncoding];
+}
+
+static int _CompareEntryReferences(const void* reference1, const void* reference2) {
+  uint64_t sequence1 = ((const EntryReference*)reference1)->sequence;
+  uint64_t sequence2 = ((const EntryReference*)reference2)->sequence;
+  return sequence1 < sequence2 ? -1 : (sequence1 > sequence2 ? 1 : 0);
+}
+
+@implementation XLFlightRecorderLogger {
+  unsigned char* _mapping;
+  size_t _mappingSize;
+  int _recording;  // Atomically set while the logger is opened
+}
+
+- (id)init {
+  [self doesNotRecognizeSelector:_cmd];
+  return nil;
+}
+
+- (instancetype)initWithFilePath:(NSString*)path {
+  return [self initWithFilePath:path recordCount:kDefaultRecordCount recordSize:kDefaultRecordSize];
+}
+
+- (instancetype)initWithFilePath:(NSString*)path recordCount:(NSUInteger)count recordSize:(NSUInteger)size {
+  XLOG_DEBUG_CHECK(count > 0);
+  XLOG_DEBUG_CHECK((size >= kMinRecordSize) && (size <= kMaxRecordSize));
+  if ((self = [super init])) {
+    _filePath = [path copy];
+    _recordCount = MAX(count, 1);
+    _recordSize = MIN(MAX(size, kMinRecordSize), kMaxRecordSize) & ~(NSUInteger)7;  // Keep entries 8-byte aligned
+  }
+  return self;
+}
+
+// The mapping is kept until the logger is destroyed so it can be reopened and is only unmapped once no signal handler can still be writing to it
+- (void)dealloc {
+  if (_mapping) {
+    _UnregisterRing(_mapping);
+    while (__atomic_load_n(&_signalSafeWriters, __ATOMIC_SEQ_CST)) {
+      sched_yield();
+    }
+    munmap(_mapping, _mappingSize);
+  }
+}
+
+- (BOOL)logsRecordsInline {
+  return YES;
+}
+
+- (unsigned char*)_mapFile {
+  int fd = open([_filePath fileSystemRepresentation], O_CREAT | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd < 0) {
+    XLOG_ERROR(@"Failed opening flight recorder file at \"%@\": %s", _filePath, strerror(errno));
+    return NULL;
+  }
+  size_t size = kFileHeaderSize + _recordCount * _recordSize;
+  void* mapping = MAP_FAILED;
+  if (ftruncate(fd, (off_t)size) == 0) {
+    mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (mapping == MAP_FAILED) {
+    XLOG_ERROR(@"Failed mapping flight recorder file at \"%@\": %s", _filePath, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+  close(fd);  // The mapping remains valid
+
+  // Reset the file unless it was created with the same layout in which case new entries are appended to the existing ones
+  FileHeader* header = mapping;
+  if (memcmp(header->magic, kFileMagic, sizeof(header->magic)) || (header->version != kFileVersion) || (header->recordSize != _recordSize) || (header->recordCount != _recordCount)) {
+    memset(mapping, 0, size);
+    header->version = kFileVersion;
+    header->recordSize = (uint32_t)_recordSize;
+    header->recordCount = _recordCount;
+    memcpy(header->magic, kFileMagic, sizeof(header->magic));
+  }
+  _mappingSize = size;
+  return mapping;
+}
+
+- (BOOL)open {
+  if (_mapping == NULL) {
+    unsigned char* mapping = [self _mapFile];
+    if (mapping == NULL) {
+      return NO;
+    }
+    _mapping = mapping;
+  }
+  if (!_RegisterRing(_mapping)) {
+    XLOG_WARNING(@"Flight recorder at \"%@\" will not receive signal-safe log messages as %i flight recorders are already opened", _filePath, kMaxRegisteredRings);
+  }
+  __atomic_store_n(&_recording, 1, __ATOMIC_RELEASE);
+  return YES;
+}
+
+// Called directly on the thread logging the record so this must be thread-safe
+- (void)logRecord:(XLLogRecord*)record {
+  if (!__atomic_load_n(&_recording, __ATOMIC_ACQUIRE)) {  // Ignore log records received after the logger was closed
+    return;
+  }
+  unsigned char* mapping = _mapping;
+  uint64_t sequence;
+  EntryHeader* entry = _ClaimEntry(mapping, &sequence);
+  entry->absoluteTime = record.absoluteTime;
+  entry->level = record.level;
+  entry->threadID = record.capturedThreadID;
+  entry->capturedErrno = record.capturedErrno;
+  unsigned char* bytes = (unsigned char*)(entry + 1);
+  size_t available = _recordSize - sizeof(EntryHeader);
+  size_t tagLength = _CopyUTF8Bytes(record.tag, bytes, available / 2);
+  size_t messageLength = _CopyUTF8Bytes(record.message, bytes + tagLength, available - tagLength);
+  entry->tagLength = (uint16_t)tagLength;
+  entry->messageLength = (uint16_t)messageLength;
+  _PublishEntry(entry, sequence);
+}
+
+- (void)close {
+  __atomic_store_n(&_recording, 0, __ATOMIC_RELEASE);
+  _UnregisterRing(_mapping);
+  msync(_mapping, _mappingSize, MS_ASYNC);
+}
+
++ (BOOL)enumerateRecordsInFileAtPath:(NSString*)path usingBlock:(void (^)(XLLogRecord* record, BOOL* stop))block {
+  NSData* data = [[NSData alloc] initWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:NULL];
+  const FileHeader* header = data.bytes;
+  if ((data.length < kFileHeaderSize) || memcmp(header->magic, kFileMagic, sizeof(header->magic)) || (header->version != kFileVersion)) {
+    return NO;
+  }
+  uint64_t count = header->recordCount;
+  size_t size = header->recordSize;
+  if ((size < kMinRecordSize) || (size > kMaxRecordSize) || (count == 0) || (count > (data.length - kFileHeaderSize) / size)) {
+    return NO;
+  }
+
+  // Entries are only valid if they are complete and at the location matching their sequence number
+  const unsigned char* entries = (const unsigned char*)data.bytes + kFileHeaderSize;
+  EntryReference* references = malloc((size_t)count * sizeof(EntryReference));
+  size_t referenceCount = 0;
+  for (uint64_t i = 0; i < count; ++i) {
+    const EntryHeader* entry = (const EntryHeader*)(entries + i * size);
+    if (entry->sequence && ((entry->sequence - 1) % count == i) && (sizeof(EntryHeader) + entry->tagLength + entry->messageLength <= size)) {
+      references[referenceCount].sequence = entry->sequence;
+      references[referenceCount].index = i;
+      ++referenceCount;
+    }
+  }
+  qsort(references, referenceCount, sizeof(EntryReference), _CompareEntryReferences);
+
+  BOOL stop = NO;
+  for (size_t i = 0; (i < referenceCount) && !stop; ++i) {
+    @autoreleasepool {
+      const EntryHeader* entry = (const EntryHeader*)(entries + references[i].index * size);
+      const unsigned char* bytes = (const unsigned char*)(entry + 1);
+      XLLogRecord* record = [[XLLogRecord alloc] initWithAbsoluteTime:entry->absoluteTime
+                                                                  tag:(entry->tagLength ? _StringFromUTF8Bytes(bytes, entry->tagLength) : nil)
+                                                                level:entry->level
+                                                              message:_StringFromUTF8Bytes(bytes + entry->tagLength, entry->messageLength)
+                                                             metadata:nil
+                                                        capturedErrno:entry->capturedErrno
+                                                     capturedThreadID:entry->threadID
+                                                   capturedQueueLabel:nil
+                                                            callstack:nil];
+      block(record, &stop);
+    }
+  }
+  free(references);
+  return YES;
+}
+
+@end
@@ -54,6 +54,69 @@ NSData* _Nullable XLConvertNSStringToUTF8String(NSString* _Nullable string);
  */
 const char* _Nullable XLConvertNSStringToUTF8CString(NSString* _Nullable string);
 
+/**
+ *  Returns the current value of a monotonic clock in nanoseconds.
+ *
+ *  This clock is not affected by wall-clock adjustments (e.g. NTP) and has
+ *  an arbitrary origin. It keeps advancing while the device is asleep except
+ *  on systems older than iOS 10 and OS X 10.12.
+ */
+uint64_t XLGetMonotonicTime();
+
+/**
+ *  Converts a value returned by XLGetMonotonicTime() to an absolute time.
+ *
+ *  The wall-clock offset is periodically recalibrated and backward adjustments
+ *  are absorbed progressively so that converted times never go backward.
+ */
+CFAbsoluteTime XLAbsoluteTimeFromMonotonicTime(uint64_t monotonicTime);
+
+/**
+ *  Registers a file descriptor XLLogSignalSafeMessage() and
+ *  XLLogSignalSafeCallstack() write to e.g. STDERR_FILENO or a file opened
+ *  ahead of time to save crash information.
+ *
+ *  Returns NO if too many file descriptors are already registered.
+ *
+ *  @warning This function is not async-signal-safe.
+ */
+BOOL XLRegisterSignalSafeFileDescriptor(int fd);
+
+/**
+ *  Unregisters a file descriptor registered with
+ *  XLRegisterSignalSafeFileDescriptor().
+ *
+ *  @warning This function is not async-signal-safe.
+ */
+void XLUnregisterSignalSafeFileDescriptor(int fd);
+
+/**
+ *  Logs a message from a context where XLFacility cannot be used like a signal
+ *  handler, bypassing XLFacility and all loggers entirely.
+ *
+ *  The message is written as a single line to the registered file descriptors
+ *  as well as to the opened XLFlightRecorderLogger instances. This function
+ *  only calls write() and time() which are async-signal-safe, and uses a
+ *  preallocated scratch buffer: it never allocates memory or takes locks.
+ *  Since the thread ID cannot be retrieved in an async-signal-safe way, it is
+ *  always 0 in the XLFlightRecorderLogger entries.
+ *
+ *  Pass NULL for "tag" if you don't need one.
+ */
+void XLLogSignalSafeMessage(const char* _Nullable tag, int level, const char* message);
+
+/**
+ *  Logs the callstack of the current thread in the same way as
+ *  XLLogSignalSafeMessage().
+ *
+ *  Only the raw frame addresses are written, several per line, as symbolicating
+ *  them is not async-signal-safe: use tools like atos along with the load
+ *  addresses of the binary images to symbolicate them offline. Retrieving the
+ *  frames relies on backtrace() which is not formally async-signal-safe but
+ *  does not lock or allocate memory.
+ */
+void XLLogSignalSafeCallstack(const char* _Nullable tag, int level);
+
 /**
  *  Check if a debugger is currently attached to the process.
  */
@@ -30,25 +30,48 @@
 #endif
 
 #import <sys/sysctl.h>
+#import <execinfo.h>
+#import <pthread.h>
+#import <mach/mach_time.h>
+#import <dlfcn.h>
 
 #import "XLFunctions.h"
 #import "XLFacilityPrivate.h"
+#import "XLFacilityCMacros.h"  // Only declares XLLogCMessage() after XLFacilityMacros.h
 
 #define kInvalidUTF8Placeholder "<INVALID UTF8 STRING>"
 
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wformat-nonliteral"
+#define kClockCalibrationInterval 1000000000ULL  // 1s
+#define kClockMinSlewRate 0.5  // Wall-clock time never runs slower than half speed while absorbing a backward adjustment
+
+#define kMaxSignalSafeFileDescriptors 8
+#define kSignalSafeBufferSize 4096
+#define kSignalSafeFallbackBufferSize 256
+#define kMaxSignalSafeFrames 128
+#define kSignalSafeFramesPerEntry 8
+
+typedef uint64_t (*MachTimeFunction)(void);
+
+static mach_timebase_info_data_t _timebaseInfo;
+static MachTimeFunction _machTimeFunction = NULL;
+static pthread_mutex_t _clockMutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int _clockSequence = 0;  // Odd while the calibration below is being updated
+static uint64_t _clockAnchorTime = 0;
+static CFAbsoluteTime _clockAnchorAbsoluteTime = 0.0;
+static double _clockRate = 1.0;
+static uint64_t _clockNextCalibrationTime = 0;
+
+static int _signalSafeFileDescriptors[kMaxSignalSafeFileDescriptors];  // Stored as fd + 1 so that 0 means unused
+static char _signalSafeBuffer[kSignalSafeBufferSize];
+static char _signalSafeBufferLock = 0;
 
 void XLLogCMessage(const char* tag, int level, const char* format, ...) {
   va_list arguments;
   va_start(arguments, format);
-  NSString* message = [[NSString alloc] initWithFormat:(id)[NSString stringWithUTF8String:format] arguments:arguments];
+  [XLSharedFacility logCMessageWithTag:tag level:level format:format arguments:arguments];
   va_end(arguments);
-  [XLSharedFacility logMessage:message withTag:(tag ? [NSString stringWithUTF8String:tag] : nil)level:level];
 }
 
-#pragma clang diagnostic pop
-
 NSString* XLStringFromLogLevelName(XLLogLevel level) {
   static NSString* names[] = { @"DEBUG",
                                @"VERBOSE",
@@ -79,6 +102,287 @@ NSString* XLPaddedStringFromLogLevelName(XLLogLevel level) {
   return @"";
 }
 
+void XLByteBufferInit(XLByteBuffer* buffer, void* storage, size_t capacity) {
+  buffer->bytes = storage;
+  buffer->length = 0;
+  buffer->capacity = storage ? capacity : 0;
+  buffer->onHeap = NO;
+}
+
+void XLByteBufferReserve(XLByteBuffer* buffer, size_t length) {
+  if (buffer->capacity - buffer->length < length) {
+    size_t capacity = MAX(2 * buffer->capacity, buffer->length + length);
+    if (buffer->onHeap) {
+      buffer->bytes = realloc(buffer->bytes, capacity);
+    } else {
+      unsigned char* bytes = malloc(capacity);
+      if (buffer->length) {
+        memcpy(bytes, buffer->bytes, buffer->length);
+      }
+      buffer->bytes = bytes;
+      buffer->onHeap = YES;
+    }
+    buffer->capacity = capacity;
+  }
+}
+
+void XLByteBufferAppend(XLByteBuffer* buffer, const void* bytes, size_t length) {
+  XLByteBufferReserve(buffer, length);
+  memcpy(buffer->bytes + buffer->length, bytes, length);
+  buffer->length += length;
+}
+
+void XLByteBufferDestroy(XLByteBuffer* buffer) {
+  if (buffer->onHeap) {
+    free(buffer->bytes);
+  }
+  buffer->bytes = NULL;
+  buffer->length = 0;
+  buffer->capacity = 0;
+  buffer->onHeap = NO;
+}
+
+// mach_continuous_time() keeps advancing while the device is asleep contrary to mach_absolute_time() but is only available on iOS 10 and OS X 10.12 or later
+uint64_t XLGetMonotonicTime() {
+  MachTimeFunction function = __atomic_load_n(&_machTimeFunction, __ATOMIC_ACQUIRE);
+  if (__builtin_expect(function == NULL, 0)) {
+    mach_timebase_info_data_t info;
+    mach_timebase_info(&info);
+    __atomic_store_n(&_timebaseInfo.numer, info.numer, __ATOMIC_RELAXED);
+    __atomic_store_n(&_timebaseInfo.denom, info.denom, __ATOMIC_RELAXED);
+    *(void**)&function = dlsym(RTLD_DEFAULT, "mach_continuous_time");  // Both functions use the same timebase
+    if (function == NULL) {
+      function = mach_absolute_time;
+    }
+    __atomic_store_n(&_machTimeFunction, function, __ATOMIC_RELEASE);
+  }
+  uint64_t time = function();
+  if (_timebaseInfo.numer != _timebaseInfo.denom) {
+    time = time / _timebaseInfo.denom * _timebaseInfo.numer + time % _timebaseInfo.denom * _timebaseInfo.numer / _timebaseInfo.denom;  // Avoid overflowing
+  }
+  return time;
+}
+
+// Forward wall-clock adjustments are applied immediately while backward ones are absorbed by slowing down the mapping so converted times never go backward
+static void _CalibrateClock(uint64_t monotonicTime) {
+  if (pthread_mutex_trylock(&_clockMutex) == 0) {  // Never block the caller as another thread is already recalibrating
+    if (monotonicTime >= _clockNextCalibrationTime) {
+      CFAbsoluteTime absoluteTime = CFAbsoluteTimeGetCurrent();
+      CFAbsoluteTime anchorAbsoluteTime = absoluteTime;
+      double rate = 1.0;
+      if (_clockNextCalibrationTime) {
+        CFAbsoluteTime mappedTime = _clockAnchorAbsoluteTime + (double)(monotonicTime - _clockAnchorTime) * _clockRate / (double)NSEC_PER_SEC;
+        if (absoluteTime < mappedTime) {
+          anchorAbsoluteTime = mappedTime;
+          rate = MAX(1.0 + (absoluteTime - mappedTime) * (double)NSEC_PER_SEC / (double)kClockCalibrationInterval, kClockMinSlewRate);
+        }
+      }
+      __atomic_add_fetch(&_clockSequence, 1, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+      __atomic_store(&_clockAnchorTime, &monotonicTime, __ATOMIC_RELAXED);
+      __atomic_store(&_clockAnchorAbsoluteTime, &anchorAbsoluteTime, __ATOMIC_RELAXED);
+      __atomic_store(&_clockRate, &rate, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&_clockSequence, 1, __ATOMIC_RELEASE);
+      __atomic_store_n(&_clockNextCalibrationTime, monotonicTime + kClockCalibrationInterval, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&_clockMutex);
+  }
+}
+
+CFAbsoluteTime XLAbsoluteTimeFromMonotonicTime(uint64_t monotonicTime) {
+  if (monotonicTime >= __atomic_load_n(&_clockNextCalibrationTime, __ATOMIC_ACQUIRE)) {
+    _CalibrateClock(monotonicTime);
+  }
+  unsigned int sequence;
+  uint64_t anchorTime;
+  CFAbsoluteTime anchorAbsoluteTime;
+  double rate;
+  do {
+    sequence = __atomic_load_n(&_clockSequence, __ATOMIC_ACQUIRE);
+    __atomic_load(&_clockAnchorTime, &anchorTime, __ATOMIC_RELAXED);
+    __atomic_load(&_clockAnchorAbsoluteTime, &anchorAbsoluteTime, __ATOMIC_RELAXED);
+    __atomic_load(&_clockRate, &rate, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((sequence & 1) || (sequence != __atomic_load_n(&_clockSequence, __ATOMIC_RELAXED)));
+  if (monotonicTime < anchorTime) {  // Time captured before a concurrent recalibration
+    return anchorAbsoluteTime - (double)(anchorTime - monotonicTime) / (double)NSEC_PER_SEC;
+  }
+  return anchorAbsoluteTime + (double)(monotonicTime - anchorTime) * rate / (double)NSEC_PER_SEC;
+}
+
+void XLByteBufferAppendJSONBytes(XLByteBuffer* buffer, const void* bytes, size_t length) {
+  static const char hex[] = "0123456789abcdef";
+  const unsigned char* string = bytes;
+  const unsigned char* end = string + length;
+  const unsigned char* start = string;
+  XLByteBufferReserve(buffer, length + 2);
+  XLByteBufferAppend(buffer, "\"", 1);
+  while (string < end) {
+    if (end - string >= (ptrdiff_t)sizeof(uint64_t)) {  // Skip 8 bytes at a time while none of them needs escaping
+      uint64_t word;
+      memcpy(&word, string, sizeof(word));
+      if (!(XLWordHasByteLessThan(word, 0x20) | XLWordHasByte(word, '"') | XLWordHasByte(word, '\\'))) {
+        string += sizeof(word);
+        continue;
+      }
+    }
+    unsigned char c = *string;
+    if ((c >= 0x20) && (c != '"') && (c != '\\')) {
+      ++string;
+      continue;
+    }
+    if (string > start) {
+      XLByteBufferAppend(buffer, start, (size_t)(string - start));
+    }
+    switch (c) {
+      case '"':
+        XLByteBufferAppend(buffer, "\\\"", 2);
+        break;
+      case '\\':
+        XLByteBufferAppend(buffer, "\\\\", 2);
+        break;
+      case '\n':
+        XLByteBufferAppend(buffer, "\\n", 2);
+        break;
+      case '\r':
+        XLByteBufferAppend(buffer, "\\r", 2);
+        break;
+      case '\t':
+        XLByteBufferAppend(buffer, "\\t", 2);
+        break;
+      default: {
+        char escape[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+        XLByteBufferAppend(buffer, escape, sizeof(escape));
+        break;
+      }
+    }
+    start = ++string;
+  }
+  if (string > start) {
+    XLByteBufferAppend(buffer, start, (size_t)(string - start));
+  }
+  XLByteBufferAppend(buffer, "\"", 1);
+}
+
+void XLByteBufferAppendJSONString(XLByteBuffer* buffer, const char* string) {
+  XLByteBufferAppendJSONBytes(buffer, string, strlen(string));
+}
+
+BOOL XLRegisterSignalSafeFileDescriptor(int fd) {
+  for (int i = 0; i < kMaxSignalSafeFileDescriptors; ++i) {
+    int empty = 0;
+    if (__atomic_compare_exchange_n(&_signalSafeFileDescriptors[i], &empty, fd + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+      return YES;
+    }
+  }
+  return NO;
+}
+
+void XLUnregisterSignalSafeFileDescriptor(int fd) {
+  for (int i = 0; i < kMaxSignalSafeFileDescriptors; ++i) {
+    int value = fd + 1;
+    if (__atomic_compare_exchange_n(&_signalSafeFileDescriptors[i], &value, 0, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+}
+
+static void _WriteSignalSafe(const char* bytes, size_t length) {
+  for (int i = 0; i < kMaxSignalSafeFileDescriptors; ++i) {
+    int fd = __atomic_load_n(&_signalSafeFileDescriptors[i], __ATOMIC_ACQUIRE) - 1;
+    if (fd >= 0) {
+      size_t offset = 0;
+      while (offset < length) {
+        ssize_t result = write(fd, bytes + offset, length - offset);
+        if (result > 0) {
+          offset += (size_t)result;
+        } else if ((result < 0) && (errno == EINTR)) {
+          continue;
+        } else {
+          break;
+        }
+      }
+    }
+  }
+}
+
+// Truncates the string if necessary while always leaving room for a trailing newline
+static size_t _AppendSignalSafe(char* buffer, size_t size, size_t length, const char* string) {
+  while (*string && (length < size - 1)) {
+    buffer[length++] = *string++;
+  }
+  return length;
+}
+
+static size_t _AppendHexSignalSafe(char* buffer, size_t size, size_t length, uintptr_t value) {
+  static const char hex[] = "0123456789abcdef";
+  char digits[2 + 2 * sizeof(uintptr_t) + 1];
+  size_t index = sizeof(digits) - 1;
+  digits[index] = 0;
+  do {
+    digits[--index] = hex[value & 0xF];
+    value >>= 4;
+  } while (value);
+  digits[--index] = 'x';
+  digits[--index] = '0';
+  return _AppendSignalSafe(buffer, size, length, &digits[index]);
+}
+
+static size_t _FormatSignalSafeLine(char* buffer, size_t size, const char* tag, int level, const char* message) {
+  static const char* names[] = { "DEBUG    ",
+                                 "VERBOSE  ",
+                                 "INFO     ",
+                                 "WARNING  ",
+                                 "ERROR    ",
+                                 "EXCEPTION",
+                                 "ABORT    " };
+  size_t length = _AppendSignalSafe(buffer, size, 0, "[");
+  length = _AppendSignalSafe(buffer, size, length, names[MIN(MAX(level, kXLMinLogLevel), kXLMaxLogLevel)]);
+  length = _AppendSignalSafe(buffer, size, length, "]> ");
+  if (tag) {
+    length = _AppendSignalSafe(buffer, size, length, "(");
+    length = _AppendSignalSafe(buffer, size, length, tag);
+    length = _AppendSignalSafe(buffer, size, length, ") ");
+  }
+  length = _AppendSignalSafe(buffer, size, length, message);
+  buffer[length++] = '\n';
+  return length;
+}
+
+void XLLogSignalSafeMessage(const char* tag, int level, const char* message) {
+  int savedErrno = errno;
+  XLFlightRecorderWriteSignalSafe(level, tag, message, strlen(message));
+  if (!__atomic_test_and_set(&_signalSafeBufferLock, __ATOMIC_ACQUIRE)) {
+    _WriteSignalSafe(_signalSafeBuffer, _FormatSignalSafeLine(_signalSafeBuffer, sizeof(_signalSafeBuffer), tag, level, message));
+    __atomic_clear(&_signalSafeBufferLock, __ATOMIC_RELEASE);
+  } else {  // Another thread is crashing at the same time and using the scratch buffer
+    char buffer[kSignalSafeFallbackBufferSize];
+    _WriteSignalSafe(buffer, _FormatSignalSafeLine(buffer, sizeof(buffer), tag, level, message));
+  }
+  errno = savedErrno;
+}
+
+// Symbolicating frames (e.g. with backtrace_symbols_fd()) would call dladdr() which takes the dyld lock so only raw addresses are written
+void XLLogSignalSafeCallstack(const char* tag, int level) {
+  int savedErrno = errno;
+  void* frames[kMaxSignalSafeFrames];
+  int count = backtrace(frames, kMaxSignalSafeFrames);  // Only walks the stack without locking or allocating memory
+  XLLogSignalSafeMessage(tag, level, "Callstack:");
+  char buffer[kSignalSafeFallbackBufferSize];
+  size_t length = 0;
+  for (int i = 0; i < count; ++i) {
+    length = _AppendHexSignalSafe(buffer, sizeof(buffer), length, (uintptr_t)frames[i]);
+    if ((i % kSignalSafeFramesPerEntry == kSignalSafeFramesPerEntry - 1) || (i == count - 1)) {
+      buffer[length] = 0;
+      XLLogSignalSafeMessage(tag, level, buffer);
+      length = 0;
+    } else {
+      length = _AppendSignalSafe(buffer, sizeof(buffer), length, " ");
+    }
+  }
+  errno = savedErrno;
+}
+
 NSData* XLConvertNSStringToUTF8String(NSString* string) {
   NSData* utf8Data = nil;
   if (string) {
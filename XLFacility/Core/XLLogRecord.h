@@ -40,6 +40,17 @@ NS_ASSUME_NONNULL_BEGIN
  */
 @property(nonatomic, readonly) CFAbsoluteTime absoluteTime;
 
+/**
+ *  Returns the value of the monotonic clock in nanoseconds when the message
+ *  was logged or 0 if not available (e.g. records read back from a database).
+ *
+ *  Contrary to "absoluteTime", this value is unaffected by wall-clock
+ *  adjustments and is suitable to measure intervals between records.
+ *
+ *  @see XLGetMonotonicTime()
+ */
+@property(nonatomic, readonly) uint64_t monotonicTime;
+
 /**
  *  Returns the tag used when logging the message (may be nil).
  */
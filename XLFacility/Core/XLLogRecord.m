@@ -30,10 +30,260 @@
 #endif
 
 #import <pthread.h>
+#import <objc/runtime.h>
+#import <execinfo.h>
 
 #import "XLLogRecord.h"
+#import "XLFunctions.h"
+#import "XLFacilityPrivate.h"
 
-@implementation XLLogRecord
+// Equivalent of object_getIndexedIvars() for objects created with class_createInstance() which is not available with ARC
+static inline void* _GetExtraBytes(id object) {
+  return (unsigned char*)(__bridge void*)object + class_getInstanceSize(object_getClass(object));
+}
+
+#define kMaxCachedSymbols 4096
+#define kMaxSymbolicatedFrames 256
+
+static pthread_mutex_t _symbolCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static CFMutableDictionaryRef _symbolCache = NULL;  // Frame address -> symbol without the frame index
+
+// Returns the part of a backtrace_symbols() string after the frame index
+static const char* _SkipFrameIndex(const char* string) {
+  while ((*string >= '0') && (*string <= '9')) {
+    ++string;
+  }
+  while (*string == ' ') {
+    ++string;
+  }
+  return string;
+}
+
+// Only frames never seen before are passed to backtrace_symbols() which is quite expensive
+static NSArray* _SymbolicateFrames(void* const* frames, int count) {
+  CFTypeRef symbols[kMaxSymbolicatedFrames];
+  void* missingFrames[kMaxSymbolicatedFrames];
+  count = MIN(count, kMaxSymbolicatedFrames);
+  int missingCount = 0;
+  pthread_mutex_lock(&_symbolCacheMutex);
+  if (_symbolCache == NULL) {
+    _symbolCache = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, NULL, &kCFTypeDictionaryValueCallBacks);
+  }
+  for (int i = 0; i < count; ++i) {
+    symbols[i] = CFDictionaryGetValue(_symbolCache, frames[i]);
+    if (symbols[i]) {
+      CFRetain(symbols[i]);
+    } else {
+      missingFrames[missingCount++] = frames[i];
+    }
+  }
+  pthread_mutex_unlock(&_symbolCacheMutex);
+
+  if (missingCount) {
+    char** strings = backtrace_symbols(missingFrames, missingCount);
+    if (strings == NULL) {
+      for (int i = 0; i < count; ++i) {
+        if (symbols[i]) {
+          CFRelease(symbols[i]);
+        }
+      }
+      return nil;
+    }
+    pthread_mutex_lock(&_symbolCacheMutex);
+    if (CFDictionaryGetCount(_symbolCache) + missingCount > kMaxCachedSymbols) {
+      CFDictionaryRemoveAllValues(_symbolCache);
+    }
+    for (int i = 0, j = 0; i < count; ++i) {
+      if (symbols[i] == NULL) {
+        symbols[i] = CFBridgingRetain([NSString stringWithUTF8String:_SkipFrameIndex(strings[j++])] ?: @"");
+        CFDictionarySetValue(_symbolCache, frames[i], symbols[i]);
+      }
+    }
+    pthread_mutex_unlock(&_symbolCacheMutex);
+    free(strings);  // No need to free individual strings
+  }
+
+  NSMutableArray* callstack = [[NSMutableArray alloc] initWithCapacity:count];
+  for (int i = 0; i < count; ++i) {
+    [callstack addObject:[NSString stringWithFormat:@"%-4i%@", i, CFBridgingRelease(symbols[i])]];  // Use the same format as -[NSException callStackSymbols]
+  }
+  return callstack;
+}
+
+#define kQueueLabelCacheSize 4
+
+// Per-thread state to avoid system calls and string allocations when capturing the context of log records
+typedef struct {
+  uint64_t threadID;
+  unsigned int nextLabel;
+  const char* labelPointers[kQueueLabelCacheSize];
+  char* labels[kQueueLabelCacheSize];
+  CFTypeRef labelStrings[kQueueLabelCacheSize];
+} ThreadContext;
+
+static pthread_key_t _threadContextKey;
+static BOOL _queueLabelsAvailable = NO;
+
+static void _DestroyThreadContext(void* value) {
+  ThreadContext* context = value;
+  for (int i = 0; i < kQueueLabelCacheSize; ++i) {
+    free(context->labels[i]);
+    if (context->labelStrings[i]) {
+      CFRelease(context->labelStrings[i]);
+    }
+  }
+  free(context);
+}
+
+static ThreadContext* _GetThreadContext() {
+  ThreadContext* context = pthread_getspecific(_threadContextKey);
+  if (context == NULL) {
+    context = calloc(1, sizeof(ThreadContext));
+    pthread_threadid_np(pthread_self(), &context->threadID);
+    pthread_setspecific(_threadContextKey, context);
+  }
+  return context;
+}
+
+// Labels are matched by pointer first then verified by content since queues can be destroyed and their labels reused
+static NSString* _GetCachedQueueLabel(ThreadContext* context, const char* label) {
+  if ((label == NULL) || !label[0]) {
+    return nil;
+  }
+  for (int i = 0; i < kQueueLabelCacheSize; ++i) {
+    if (context->labels[i] && (context->labelPointers[i] == label) && !strcmp(context->labels[i], label)) {
+      return (__bridge NSString*)context->labelStrings[i];
+    }
+  }
+  for (int i = 0; i < kQueueLabelCacheSize; ++i) {
+    if (context->labels[i] && !strcmp(context->labels[i], label)) {
+      context->labelPointers[i] = label;
+      return (__bridge NSString*)context->labelStrings[i];
+    }
+  }
+  unsigned int index = context->nextLabel;
+  context->nextLabel = (index + 1) % kQueueLabelCacheSize;
+  free(context->labels[index]);
+  if (context->labelStrings[index]) {
+    CFRelease(context->labelStrings[index]);
+  }
+  context->labelPointers[index] = label;
+  context->labels[index] = strdup(label);
+  context->labelStrings[index] = CFBridgingRetain([NSString stringWithUTF8String:label] ?: @"");
+  return (__bridge NSString*)context->labelStrings[index];
+}
+
+// Same layout as XLMetadataItem but keys are interned NSStrings and values retained
+typedef struct {
+  CFStringRef key;
+  XLMetadataType type;
+  union {
+    long long intValue;
+    double doubleValue;
+    BOOL boolValue;
+    CFStringRef stringValue;
+  } value;
+} MetadataItem;
+
+static pthread_mutex_t _metadataKeysMutex = PTHREAD_MUTEX_INITIALIZER;
+static CFMutableDictionaryRef _metadataKeys = NULL;  // C string address -> NSString
+
+static CFStringRef _InternMetadataKey(const char* key) {
+  pthread_mutex_lock(&_metadataKeysMutex);
+  if (_metadataKeys == NULL) {
+    _metadataKeys = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, NULL, &kCFTypeDictionaryValueCallBacks);
+  }
+  CFStringRef string = CFDictionaryGetValue(_metadataKeys, key);
+  if (string == NULL) {
+    string = CFStringCreateWithCString(kCFAllocatorDefault, key, kCFStringEncodingUTF8);
+    if (string == NULL) {
+      string = CFStringCreateWithCString(kCFAllocatorDefault, key, kCFStringEncodingMacRoman);  // Cannot fail
+    }
+    CFDictionarySetValue(_metadataKeys, key, string);
+    CFRelease(string);
+  }
+  pthread_mutex_unlock(&_metadataKeysMutex);
+  return string;
+}
+
+static NSString* _StringFromMetadataItem(const MetadataItem* item) {
+  switch (item->type) {
+    case kXLMetadataType_Int:
+      return [[NSString alloc] initWithFormat:@"%lli", item->value.intValue];
+    case kXLMetadataType_Double:
+      return [[NSString alloc] initWithFormat:@"%.16g", item->value.doubleValue];  // Unlike %.17g, renders 0.1 as "0.1"
+    case kXLMetadataType_Bool:
+      return item->value.boolValue ? @"true" : @"false";
+    case kXLMetadataType_String:
+      return item->value.stringValue ? (__bridge NSString*)item->value.stringValue : @"(null)";
+  }
+  return @"";
+}
+
+// Returns a pointer to an UTF-8 version of the string which is only valid until "storage" is modified
+static const char* _GetUTF8String(CFStringRef string, char* storage, size_t size) {
+  const char* utf8 = CFStringGetCStringPtr(string, kCFStringEncodingUTF8);
+  if (utf8 == NULL) {
+    utf8 = CFStringGetCString(string, storage, size, kCFStringEncodingUTF8) ? storage : XLConvertNSStringToUTF8CString((__bridge NSString*)string);
+  }
+  return utf8;
+}
+
+#define kFormattedDataBusy ((CFDataRef)(uintptr_t)1)  // Owned by a consumer which is formatting or copying it
+
+typedef struct FormattedEntry {
+  const void* key;
+  CFDataRef data;  // NULL if not formatted yet or already freed
+  int consumers;  // Loggers which will still consume the data
+  struct FormattedEntry* next;
+} FormattedEntry;
+
+static FormattedEntry* _FindFormattedEntry(FormattedEntry* entry, const void* key) {
+  while (entry && (entry->key != key)) {
+    entry = entry->next;
+  }
+  return entry;
+}
+
+// Called once a consumer has given back ownership of the data so it gets freed if no other consumer remains
+static void _ReleaseFormattedDataIfUnused(FormattedEntry* entry) {
+  if (__atomic_load_n(&entry->consumers, __ATOMIC_SEQ_CST) <= 0) {
+    CFDataRef data = __atomic_exchange_n(&entry->data, NULL, __ATOMIC_SEQ_CST);
+    if (data && (data != kFormattedDataBusy)) {
+      CFRelease(data);
+    }
+  }
+}
+
+@implementation XLLogRecord {
+  CFTypeRef _callstack;
+  void** _callstackFrames;
+  int _callstackFrameCount;
+  int _inlineFrameCapacity;
+  CFTypeRef _metadata;
+  MetadataItem* _metadataItems;
+  int _metadataItemCount;
+  int _inlineMetadataCapacity;
+  FormattedEntry* _formattedEntries;
+}
+
++ (void)initialize {
+  if (self == [XLLogRecord class]) {
+    pthread_key_create(&_threadContextKey, _DestroyThreadContext);
+#if TARGET_OS_IPHONE
+    _queueLabelsAvailable = (kCFCoreFoundationVersionNumber >= kCFCoreFoundationVersionNumber_iOS_7_0);
+#else
+    _queueLabelsAvailable = (kCFCoreFoundationVersionNumber >= kCFCoreFoundationVersionNumber10_9);  // dispatch_queue_get_label() returns garbage before iOS 7 and OS X 10.9 (e.g. an non-accessible string)
+#endif
+  }
+}
+
++ (instancetype)allocWithInlineFrameCapacity:(int)frameCapacity metadataCapacity:(int)metadataCapacity {
+  XLLogRecord* record = class_createInstance(self, (size_t)frameCapacity * sizeof(void*) + (size_t)metadataCapacity * sizeof(MetadataItem));
+  record->_inlineFrameCapacity = frameCapacity;
+  record->_inlineMetadataCapacity = metadataCapacity;
+  return record;
+}
 
 - (id)initWithAbsoluteTime:(CFAbsoluteTime)absoluteTime
                        tag:(NSString*)tag
@@ -49,44 +299,287 @@
     _tag = tag;
     _level = level;
     _message = message;
-    _metadata = metadata;
+    _metadata = metadata.count ? CFBridgingRetain(metadata) : NULL;
     _capturedErrno = capturedErrno;
     _capturedThreadID = capturedThreadID;
     _capturedQueueLabel = capturedQueueLabel;
-    _callstack = callstack;
+    _callstack = callstack ? CFBridgingRetain(callstack) : NULL;
   }
   return self;
 }
 
-- (id)initWithAbsoluteTime:(CFAbsoluteTime)absoluteTime
-                       tag:(NSString*)tag
-                     level:(XLLogLevel)level
-                   message:(NSString*)message
-                  metadata:(NSDictionary<NSString*, NSString*>*)metadata
-                 callstack:(NSArray*)callstack {
-  const char* label = NULL;
-#if TARGET_OS_IPHONE
-  if (kCFCoreFoundationVersionNumber >= kCFCoreFoundationVersionNumber_iOS_7_0)
-#else
-  if (kCFCoreFoundationVersionNumber >= kCFCoreFoundationVersionNumber10_9)
-#endif
-  {
-    label = dispatch_queue_get_label(DISPATCH_CURRENT_QUEUE_LABEL);  // This returns garbage before iOS 7 and OS X 10.9 (e.g. an non-accessible string)
-    if (!label[0]) {
-      label = NULL;
+- (id)initWithMonotonicTime:(uint64_t)monotonicTime
+                        tag:(NSString*)tag
+                      level:(XLLogLevel)level
+                    message:(NSString*)message
+                   metadata:(NSDictionary<NSString*, NSString*>*)metadata
+                  callstack:(NSArray*)callstack {
+  int capturedErrno = errno;
+  ThreadContext* context = _GetThreadContext();
+  NSString* label = nil;
+  if (_queueLabelsAvailable) {
+    label = _GetCachedQueueLabel(context, dispatch_queue_get_label(DISPATCH_CURRENT_QUEUE_LABEL));
+  }
+  if ((self = [self initWithAbsoluteTime:XLAbsoluteTimeFromMonotonicTime(monotonicTime)
+                                     tag:tag
+                                   level:level
+                                 message:message
+                                metadata:metadata
+                           capturedErrno:capturedErrno
+                        capturedThreadID:(int)context->threadID
+                      capturedQueueLabel:label
+                               callstack:callstack])) {
+    _monotonicTime = monotonicTime;
+  }
+  return self;
+}
+
+- (void)dealloc {
+  if (_callstack) {
+    CFRelease(_callstack);
+  }
+  if (_callstackFrames && (_callstackFrameCount > _inlineFrameCapacity)) {
+    free(_callstackFrames);
+  }
+  if (_metadata) {
+    CFRelease(_metadata);
+  }
+  for (int i = 0; i < _metadataItemCount; ++i) {
+    CFRelease(_metadataItems[i].key);
+    if ((_metadataItems[i].type == kXLMetadataType_String) && _metadataItems[i].value.stringValue) {
+      CFRelease(_metadataItems[i].value.stringValue);
+    }
+  }
+  if (_metadataItems && (_metadataItemCount > _inlineMetadataCapacity)) {
+    free(_metadataItems);
+  }
+  FormattedEntry* entry = _formattedEntries;
+  while (entry) {
+    FormattedEntry* next = entry->next;
+    if (entry->data && (entry->data != kFormattedDataBusy)) {
+      CFRelease(entry->data);  // Some consumers dropped the log record without going through -removeFormattedDataConsumerForKey:
+    }
+    free(entry);
+    entry = next;
+  }
+}
+
+- (void)setCallstackFrames:(void* const*)frames count:(int)count {
+  _callstackFrames = count <= _inlineFrameCapacity ? _GetExtraBytes(self) : malloc((size_t)count * sizeof(void*));
+  memcpy(_callstackFrames, frames, (size_t)count * sizeof(void*));
+  _callstackFrameCount = count;
+}
+
+- (MetadataItem*)_allocateMetadataItems:(int)count {
+  _metadataItems = count <= _inlineMetadataCapacity ? (MetadataItem*)((void**)_GetExtraBytes(self) + _inlineFrameCapacity) : malloc((size_t)count * sizeof(MetadataItem));
+  return _metadataItems;
+}
+
+- (void)setMetadataList:(const XLMetadataList*)list {
+  int count = (int)list->count;
+  if (count > 0) {
+    MetadataItem* items = [self _allocateMetadataItems:count];
+    for (int i = 0; i < count; ++i) {
+      const XLMetadataItem* item = &list->items[i];
+      items[i].key = CFRetain(_InternMetadataKey(item->key));
+      items[i].type = item->type;
+      switch (item->type) {
+        case kXLMetadataType_Int:
+          items[i].value.intValue = item->value.intValue;
+          break;
+        case kXLMetadataType_Double:
+          items[i].value.doubleValue = item->value.doubleValue;
+          break;
+        case kXLMetadataType_Bool:
+          items[i].value.boolValue = item->value.boolValue;
+          break;
+        case kXLMetadataType_String:
+          items[i].value.stringValue = item->value.stringValue ? (CFStringRef)CFBridgingRetain([item->value.stringValue copy]) : NULL;
+          break;
+      }
+    }
+    _metadataItemCount = count;
+  }
+}
+
+// Values are rendered with -description right away like XLFacility always did for NSDictionary metadata (e.g. @YES as "1")
+- (void)setMetadataDictionary:(NSDictionary<NSString*, id>*)dictionary {
+  int count = (int)dictionary.count;
+  if (count > 0) {
+    MetadataItem* items = [self _allocateMetadataItems:count];
+    __block int index = 0;
+    [dictionary enumerateKeysAndObjectsUsingBlock:^(NSString* key, id value, BOOL* stop) {
+      MetadataItem* item = &items[index++];
+      item->key = (CFStringRef)CFBridgingRetain([key description]);
+      item->type = kXLMetadataType_String;
+      item->value.stringValue = (CFStringRef)CFBridgingRetain([value isKindOfClass:[NSString class]] ? [value copy] : [value description]);
+    }];
+    _metadataItemCount = count;
+  }
+}
+
+// Conversion may happen concurrently on multiple logger queues so only the first result is kept
+- (NSDictionary<NSString*, NSString*>*)metadata {
+  CFTypeRef metadata = __atomic_load_n(&_metadata, __ATOMIC_ACQUIRE);
+  if ((metadata == NULL) && _metadataItemCount) {
+    NSMutableDictionary<NSString*, NSString*>* dictionary = [[NSMutableDictionary alloc] initWithCapacity:_metadataItemCount];
+    for (int i = 0; i < _metadataItemCount; ++i) {
+      [dictionary setObject:_StringFromMetadataItem(&_metadataItems[i]) forKey:(__bridge NSString*)_metadataItems[i].key];
+    }
+    CFTypeRef newMetadata = CFBridgingRetain(dictionary);
+    if (__atomic_compare_exchange_n(&_metadata, &metadata, newMetadata, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      metadata = newMetadata;
+    } else {
+      CFRelease(newMetadata);
     }
   }
-  uint64_t threadID = 0;
-  pthread_threadid_np(pthread_self(), &threadID);
-  return [self initWithAbsoluteTime:absoluteTime
-                                tag:tag
-                              level:level
-                            message:message
-                           metadata:metadata
-                      capturedErrno:errno
-                   capturedThreadID:(int)threadID
-                 capturedQueueLabel:(label ? [NSString stringWithUTF8String:label] : nil)
-                 callstack:callstack];
+  return (__bridge NSDictionary*)metadata;
+}
+
+// Values are always serialized as strings to match the "metadata" property
+- (BOOL)appendMetadataAsJSONToBuffer:(XLByteBuffer*)buffer {
+  char storage[256];
+  if (_metadataItemCount) {
+    XLByteBufferAppend(buffer, "{", 1);
+    for (int i = 0; i < _metadataItemCount; ++i) {
+      const MetadataItem* item = &_metadataItems[i];
+      if (i > 0) {
+        XLByteBufferAppend(buffer, ",", 1);
+      }
+      XLByteBufferAppendJSONString(buffer, _GetUTF8String(item->key, storage, sizeof(storage)));
+      XLByteBufferAppend(buffer, ":", 1);
+      switch (item->type) {
+        case kXLMetadataType_Int:
+          snprintf(storage, sizeof(storage), "%lli", item->value.intValue);
+          XLByteBufferAppendJSONString(buffer, storage);
+          break;
+        case kXLMetadataType_Double:
+          snprintf(storage, sizeof(storage), "%.16g", item->value.doubleValue);
+          XLByteBufferAppendJSONString(buffer, storage);
+          break;
+        case kXLMetadataType_Bool:
+          XLByteBufferAppendJSONString(buffer, item->value.boolValue ? "true" : "false");
+          break;
+        case kXLMetadataType_String:
+          XLByteBufferAppendJSONString(buffer, item->value.stringValue ? _GetUTF8String(item->value.stringValue, storage, sizeof(storage)) : "(null)");
+          break;
+      }
+    }
+    XLByteBufferAppend(buffer, "}", 1);
+    return YES;
+  }
+  NSDictionary* metadata = (__bridge NSDictionary*)_metadata;
+  if (metadata.count) {
+    __block BOOL first = YES;
+    XLByteBufferAppend(buffer, "{", 1);
+    [metadata enumerateKeysAndObjectsUsingBlock:^(NSString* key, NSString* value, BOOL* stop) {
+      if (!first) {
+        XLByteBufferAppend(buffer, ",", 1);
+      }
+      first = NO;
+      XLByteBufferAppendJSONString(buffer, XLConvertNSStringToUTF8CString(key));
+      XLByteBufferAppend(buffer, ":", 1);
+      XLByteBufferAppendJSONString(buffer, XLConvertNSStringToUTF8CString([value description]));
+    }];
+    XLByteBufferAppend(buffer, "}", 1);
+    return YES;
+  }
+  return NO;
+}
+
+// Symbolication may happen concurrently on multiple logger queues so only the first result is kept
+- (NSArray*)callstack {
+  CFTypeRef callstack = __atomic_load_n(&_callstack, __ATOMIC_ACQUIRE);
+  if ((callstack == NULL) && _callstackFrames) {
+    NSArray* symbols = _SymbolicateFrames(_callstackFrames, _callstackFrameCount);
+    if (symbols) {
+      CFTypeRef newCallstack = CFBridgingRetain(symbols);
+      if (__atomic_compare_exchange_n(&_callstack, &callstack, newCallstack, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        callstack = newCallstack;
+      } else {
+        CFRelease(newCallstack);
+      }
+    }
+  }
+  return (__bridge NSArray*)callstack;
+}
+
+- (void)addFormattedDataConsumerForKey:(const void*)key {
+  FormattedEntry* head = __atomic_load_n(&_formattedEntries, __ATOMIC_ACQUIRE);
+  FormattedEntry* entry = _FindFormattedEntry(head, key);
+  if (entry == NULL) {
+    FormattedEntry* newEntry = calloc(1, sizeof(FormattedEntry));
+    newEntry->key = key;
+    do {
+      newEntry->next = head;
+      if (__atomic_compare_exchange_n(&_formattedEntries, &head, newEntry, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        entry = newEntry;
+        break;
+      }
+      entry = _FindFormattedEntry(head, key);  // Check if another thread inserted an entry for the same key in the meantime
+    } while (entry == NULL);
+    if (entry != newEntry) {
+      free(newEntry);
+    }
+  }
+  __atomic_add_fetch(&entry->consumers, 1, __ATOMIC_SEQ_CST);
+}
+
+- (void)removeFormattedDataConsumerForKey:(const void*)key {
+  FormattedEntry* entry = _FindFormattedEntry(__atomic_load_n(&_formattedEntries, __ATOMIC_ACQUIRE), key);
+  if (entry) {
+    __atomic_sub_fetch(&entry->consumers, 1, __ATOMIC_SEQ_CST);
+    _ReleaseFormattedDataIfUnused(entry);
+  }
+}
+
+// Consumers take ownership of the data while using it: a consumer finding it busy formats on its own instead of waiting
+// Consumers which were not registered can only cause the data to be freed early or kept until -dealloc but never accessed after being freed
+- (void)appendFormattedDataForKey:(const void*)key toBuffer:(XLByteBuffer*)buffer usingBlock:(void (^)(void))block {
+  FormattedEntry* entry = _FindFormattedEntry(__atomic_load_n(&_formattedEntries, __ATOMIC_ACQUIRE), key);
+  if (entry == NULL) {
+    block();
+    return;
+  }
+  CFDataRef data = __atomic_exchange_n(&entry->data, kFormattedDataBusy, __ATOMIC_SEQ_CST);
+  if (data == kFormattedDataBusy) {
+    block();
+  } else if (data) {
+    XLByteBufferAppend(buffer, CFDataGetBytePtr(data), (size_t)CFDataGetLength(data));
+  } else {
+    size_t offset = buffer->length;
+    block();
+    if (__atomic_load_n(&entry->consumers, __ATOMIC_SEQ_CST) > 1) {  // Only keep a copy if other loggers will consume it
+      data = CFDataCreate(kCFAllocatorDefault, buffer->bytes + offset, (CFIndex)(buffer->length - offset));
+    }
+  }
+  __atomic_sub_fetch(&entry->consumers, 1, __ATOMIC_SEQ_CST);
+  if (data != kFormattedDataBusy) {
+    __atomic_store_n(&entry->data, data, __ATOMIC_SEQ_CST);
+  }
+  _ReleaseFormattedDataIfUnused(entry);
+}
+
+- (NSUInteger)estimatedSize {
+  NSUInteger size = class_getInstanceSize([self class]) + (NSUInteger)_callstackFrameCount * sizeof(void*);
+  if ([_message isKindOfClass:[XLDeferredMessage class]]) {
+    size += [(XLDeferredMessage*)_message estimatedSize];  // Don't force formatting
+  } else {
+    size += _message.length * sizeof(unichar);
+  }
+  size += (NSUInteger)_metadataItemCount * sizeof(MetadataItem);  // Don't force conversion to strings
+  for (int i = 0; i < _metadataItemCount; ++i) {
+    if ((_metadataItems[i].type == kXLMetadataType_String) && _metadataItems[i].value.stringValue) {
+      size += (NSUInteger)CFStringGetLength(_metadataItems[i].value.stringValue) * sizeof(unichar);
+    }
+  }
+  if (_metadataItemCount == 0) {
+    NSDictionary* metadata = (__bridge NSDictionary*)_metadata;
+    for (NSString* key in metadata) {
+      size += (key.length + [metadata[key] length]) * sizeof(unichar);
+    }
+  }
+  return size;
 }
 
 - (BOOL)isEqual:(id)object {
@@ -104,7 +597,9 @@
     if ((_message && !other->_message) || (!_message && other->_message) || (_message && other->_message && ![_message isEqualToString:other->_message])) {
       return NO;
     }
-    if ((_metadata && !other->_metadata) || (!_metadata && other->_metadata) || (_metadata && other->_metadata && ![_metadata isEqualToDictionary:(id)other->_metadata])) {
+    NSDictionary* metadata = self.metadata;
+    NSDictionary* otherMetadata = other.metadata;
+    if ((metadata && !otherMetadata) || (!metadata && otherMetadata) || (metadata && otherMetadata && ![metadata isEqualToDictionary:otherMetadata])) {
       return NO;
     }
     if (_capturedErrno != other->_capturedErrno) {
@@ -116,7 +611,9 @@
     if ((_capturedQueueLabel && !other->_capturedQueueLabel) || (!_capturedQueueLabel && other->_capturedQueueLabel) || (_capturedQueueLabel && other->_capturedQueueLabel && ![_capturedQueueLabel isEqualToString:(id)other->_capturedQueueLabel])) {
       return NO;
     }
-    if ((_callstack && !other->_callstack) || (!_callstack && other->_callstack) || (_callstack && other->_callstack && ![_callstack isEqualToArray:(id)other->_callstack])) {
+    NSArray* callstack = self.callstack;
+    NSArray* otherCallstack = other.callstack;
+    if ((callstack && !otherCallstack) || (!callstack && otherCallstack) || (callstack && otherCallstack && ![callstack isEqualToArray:otherCallstack])) {
       return NO;
     }
   }
@@ -128,3 +625,546 @@
 }
 
 @end
+
+typedef NS_ENUM(unsigned char, ArgumentType) {
+  kArgumentType_Unsupported = 0,
+  kArgumentType_Percent,
+  kArgumentType_Int,
+  kArgumentType_Long,
+  kArgumentType_LongLong,
+  kArgumentType_IntMax,
+  kArgumentType_Size,
+  kArgumentType_PtrDiff,
+  kArgumentType_Double,
+  kArgumentType_LongDouble,
+  kArgumentType_Pointer,
+  kArgumentType_CString,
+  kArgumentType_Object
+};
+
+typedef union {
+  int i;
+  long l;
+  long long ll;
+  intmax_t j;
+  size_t z;
+  ptrdiff_t t;
+  double d;
+  long double ld;
+  const void* p;
+} ArgumentValue;
+
+#define kMaxSpecifierLength 32
+
+// Parses the printf-style specifier starting at "string" which must point to a '%' character
+static ArgumentType _ParseSpecifier(const char* string, size_t* length, int* starCount) {
+  const char* ptr = string + 1;
+  *starCount = 0;
+  if (*ptr == '%') {
+    *length = 2;
+    return kArgumentType_Percent;
+  }
+  while (*ptr && strchr("-+ #0'", *ptr)) {
+    ++ptr;
+  }
+  if (*ptr == '*') {
+    *starCount += 1;
+    ++ptr;
+  } else {
+    while ((*ptr >= '0') && (*ptr <= '9')) {
+      ++ptr;
+    }
+    if (*ptr == '$') {
+      return kArgumentType_Unsupported;  // Positional arguments
+    }
+  }
+  if (*ptr == '.') {
+    ++ptr;
+    if (*ptr == '*') {
+      *starCount += 1;
+      ++ptr;
+    } else {
+      while ((*ptr >= '0') && (*ptr <= '9')) {
+        ++ptr;
+      }
+    }
+  }
+  char modifier = 0;
+  switch (*ptr) {
+    case 'h':
+      ptr += (ptr[1] == 'h') ? 2 : 1;
+      modifier = 'h';
+      break;
+
+    case 'l':
+      if (ptr[1] == 'l') {
+        ptr += 2;
+        modifier = 'q';
+      } else {
+        ptr += 1;
+        modifier = 'l';
+      }
+      break;
+
+    case 'q':
+    case 'j':
+    case 'z':
+    case 't':
+    case 'L':
+      modifier = *ptr;
+      ptr += 1;
+      break;
+  }
+  ArgumentType type = kArgumentType_Unsupported;
+  switch (*ptr) {
+    case 'd':
+    case 'i':
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+      switch (modifier) {
+        case 0:
+        case 'h':
+          type = kArgumentType_Int;
+          break;
+        case 'l':
+          type = kArgumentType_Long;
+          break;
+        case 'q':
+          type = kArgumentType_LongLong;
+          break;
+        case 'j':
+          type = kArgumentType_IntMax;
+          break;
+        case 'z':
+          type = kArgumentType_Size;
+          break;
+        case 't':
+          type = kArgumentType_PtrDiff;
+          break;
+      }
+      break;
+
+    case 'c':
+      type = modifier ? kArgumentType_Unsupported : kArgumentType_Int;
+      break;
+
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+      if (modifier == 0) {
+        type = kArgumentType_Double;
+      } else if (modifier == 'L') {
+        type = kArgumentType_LongDouble;
+      }
+      break;
+
+    case 'p':
+      type = modifier ? kArgumentType_Unsupported : kArgumentType_Pointer;
+      break;
+
+    case 's':
+      type = modifier ? kArgumentType_Unsupported : kArgumentType_CString;
+      break;
+
+    case '@':
+      type = (ptr == string + 1) ? kArgumentType_Object : kArgumentType_Unsupported;  // Flags, width and precision are not supported for objects
+      break;
+  }
+  *length = (size_t)(ptr - string + 1);
+  return *length < kMaxSpecifierLength ? type : kArgumentType_Unsupported;
+}
+
+static size_t _ArgumentValueSize(ArgumentType type) {
+  switch (type) {
+    case kArgumentType_Int:
+      return sizeof(int);
+    case kArgumentType_Long:
+      return sizeof(long);
+    case kArgumentType_LongLong:
+      return sizeof(long long);
+    case kArgumentType_IntMax:
+      return sizeof(intmax_t);
+    case kArgumentType_Size:
+      return sizeof(size_t);
+    case kArgumentType_PtrDiff:
+      return sizeof(ptrdiff_t);
+    case kArgumentType_Double:
+      return sizeof(double);
+    case kArgumentType_LongDouble:
+      return sizeof(long double);
+    case kArgumentType_Pointer:
+    case kArgumentType_Object:
+      return sizeof(void*);
+    default:
+      return 0;
+  }
+}
+
+// Only plain ASCII format strings without positional arguments or exotic specifiers can be captured
+static BOOL _IsFormatCapturable(const char* format) {
+  size_t length;
+  int starCount;
+  for (const char* ptr = format; *ptr; ++ptr) {
+    if ((unsigned char)*ptr >= 0x80) {
+      return NO;
+    }
+    if (*ptr == '%') {
+      if (_ParseSpecifier(ptr, &length, &starCount) == kArgumentType_Unsupported) {
+        return NO;
+      }
+      ptr += length - 1;
+    }
+  }
+  return YES;
+}
+
+// Returns the precision of a specifier or -1 if it has none (a negative star argument counts as none)
+static int _ParsePrecision(const char* specifier, size_t length, int starCount, const int* stars) {
+  const char* dot = memchr(specifier, '.', length);  // Flags and width cannot contain a dot
+  if (dot == NULL) {
+    return -1;
+  }
+  if (dot[1] == '*') {
+    return stars[starCount - 1] >= 0 ? stars[starCount - 1] : -1;
+  }
+  return atoi(dot + 1);
+}
+
+// Immutable objects are simply retained while mutable ones are snapshotted
+static id _CaptureObject(id object) {
+  if ([object conformsToProtocol:@protocol(NSCopying)]) {
+    return [object copy];
+  }
+  return [object description];
+}
+
+static void _CaptureArguments(const char* format, va_list arguments, XLByteBuffer* buffer) {
+  size_t length;
+  int starCount;
+  for (const char* ptr = strchr(format, '%'); ptr; ptr = strchr(ptr + length, '%')) {
+    ArgumentType type = _ParseSpecifier(ptr, &length, &starCount);
+    int stars[2];
+    for (int i = 0; i < starCount; ++i) {
+      stars[i] = va_arg(arguments, int);
+      XLByteBufferAppend(buffer, &stars[i], sizeof(int));
+    }
+    ArgumentValue value;
+    switch (type) {
+      case kArgumentType_Unsupported:
+      case kArgumentType_Percent:
+        continue;
+
+      case kArgumentType_Int:
+        value.i = va_arg(arguments, int);
+        break;
+
+      case kArgumentType_Long:
+        value.l = va_arg(arguments, long);
+        break;
+
+      case kArgumentType_LongLong:
+        value.ll = va_arg(arguments, long long);
+        break;
+
+      case kArgumentType_IntMax:
+        value.j = va_arg(arguments, intmax_t);
+        break;
+
+      case kArgumentType_Size:
+        value.z = va_arg(arguments, size_t);
+        break;
+
+      case kArgumentType_PtrDiff:
+        value.t = va_arg(arguments, ptrdiff_t);
+        break;
+
+      case kArgumentType_Double:
+        value.d = va_arg(arguments, double);
+        break;
+
+      case kArgumentType_LongDouble:
+        value.ld = va_arg(arguments, long double);
+        break;
+
+      case kArgumentType_Pointer:
+        value.p = va_arg(arguments, void*);
+        break;
+
+      case kArgumentType_CString: {  // Like printf, never read past the precision as the string may not be NUL-terminated
+        const char* string = va_arg(arguments, const char*);
+        int precision = _ParsePrecision(ptr, length, starCount, stars);
+        size_t stringLength = string ? (precision >= 0 ? strnlen(string, (size_t)precision) : strlen(string)) + 1 : 0;  // Zero means NULL
+        XLByteBufferAppend(buffer, &stringLength, sizeof(stringLength));
+        if (string) {
+          XLByteBufferAppend(buffer, string, stringLength - 1);
+          XLByteBufferAppend(buffer, "", 1);
+        }
+        continue;
+      }
+
+      case kArgumentType_Object: {
+        id object = va_arg(arguments, id);
+        value.p = object ? CFBridgingRetain(_CaptureObject(object)) : NULL;
+        break;
+      }
+    }
+    XLByteBufferAppend(buffer, &value, _ArgumentValueSize(type));
+  }
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wformat-nonliteral"
+
+#define PRINT_ARGUMENT(__VALUE__)                                                                                \
+  (starCount == 2 ? snprintf(destination, available, specifier, stars[0], stars[1], __VALUE__)                 \
+                  : (starCount == 1 ? snprintf(destination, available, specifier, stars[0], __VALUE__)         \
+                                    : snprintf(destination, available, specifier, __VALUE__)))
+
+static void _AppendFormattedArgument(XLByteBuffer* buffer, const char* specifier, int starCount, const int* stars, ArgumentType type, const ArgumentValue* value) {
+  XLByteBufferReserve(buffer, 64);
+  while (1) {
+    char* destination = (char*)buffer->bytes + buffer->length;
+    size_t available = buffer->capacity - buffer->length;
+    int result = -1;
+    switch (type) {
+      case kArgumentType_Int:
+        result = PRINT_ARGUMENT(value->i);
+        break;
+      case kArgumentType_Long:
+        result = PRINT_ARGUMENT(value->l);
+        break;
+      case kArgumentType_LongLong:
+        result = PRINT_ARGUMENT(value->ll);
+        break;
+      case kArgumentType_IntMax:
+        result = PRINT_ARGUMENT(value->j);
+        break;
+      case kArgumentType_Size:
+        result = PRINT_ARGUMENT(value->z);
+        break;
+      case kArgumentType_PtrDiff:
+        result = PRINT_ARGUMENT(value->t);
+        break;
+      case kArgumentType_Double:
+        result = PRINT_ARGUMENT(value->d);
+        break;
+      case kArgumentType_LongDouble:
+        result = PRINT_ARGUMENT(value->ld);
+        break;
+      case kArgumentType_Pointer:
+      case kArgumentType_CString:
+        result = PRINT_ARGUMENT(value->p);
+        break;
+      default:
+        break;
+    }
+    if (result < 0) {
+      break;
+    }
+    if ((size_t)result < available) {
+      buffer->length += (size_t)result;
+      break;
+    }
+    XLByteBufferReserve(buffer, (size_t)result + 1);
+  }
+}
+
+#pragma clang diagnostic pop
+
+static NSString* _FormatCapturedArguments(const char* format, const unsigned char* arguments) {
+  unsigned char storage[1024];
+  XLByteBuffer buffer;
+  XLByteBufferInit(&buffer, storage, sizeof(storage));
+  char specifier[kMaxSpecifierLength];
+  const char* literal = format;
+  size_t length;
+  int starCount;
+  for (const char* ptr = strchr(format, '%'); ptr; ptr = strchr(literal, '%')) {
+    XLByteBufferAppend(&buffer, literal, (size_t)(ptr - literal));
+    ArgumentType type = _ParseSpecifier(ptr, &length, &starCount);
+    literal = ptr + length;
+    int stars[2];
+    for (int i = 0; i < starCount; ++i) {
+      memcpy(&stars[i], arguments, sizeof(int));
+      arguments += sizeof(int);
+    }
+    ArgumentValue value;
+    if (type == kArgumentType_Percent) {
+      XLByteBufferAppend(&buffer, "%", 1);
+      continue;
+    }
+    if (type == kArgumentType_CString) {
+      size_t stringLength;
+      memcpy(&stringLength, arguments, sizeof(size_t));
+      arguments += sizeof(size_t);
+      value.p = stringLength ? arguments : NULL;
+      arguments += stringLength;
+    } else {
+      memcpy(&value, arguments, _ArgumentValueSize(type));
+      arguments += _ArgumentValueSize(type);
+    }
+    if (type == kArgumentType_Object) {
+      NSString* description = value.p ? [(__bridge id)value.p description] : @"(null)";
+      const char* utf8 = [description UTF8String];
+      if (utf8) {
+        XLByteBufferAppend(&buffer, utf8, strlen(utf8));
+      }
+    } else {
+      memcpy(specifier, ptr, length);
+      specifier[length] = 0;
+      _AppendFormattedArgument(&buffer, specifier, starCount, stars, type, &value);
+    }
+  }
+  XLByteBufferAppend(&buffer, literal, strlen(literal));
+  NSString* string = [[NSString alloc] initWithBytes:buffer.bytes length:buffer.length encoding:NSUTF8StringEncoding];
+  if (string == nil) {
+    string = [[NSString alloc] initWithBytes:buffer.bytes length:buffer.length encoding:NSMacOSRomanStringEncoding];  // C strings are not necessarily UTF-8
+  }
+  XLByteBufferDestroy(&buffer);
+  return string;
+}
+
+static void _ReleaseCapturedArguments(const char* format, const unsigned char* arguments) {
+  size_t length;
+  int starCount;
+  for (const char* ptr = strchr(format, '%'); ptr; ptr = strchr(ptr + length, '%')) {
+    ArgumentType type = _ParseSpecifier(ptr, &length, &starCount);
+    arguments += (size_t)starCount * sizeof(int);
+    if (type == kArgumentType_CString) {
+      size_t stringLength;
+      memcpy(&stringLength, arguments, sizeof(size_t));
+      arguments += sizeof(size_t) + stringLength;
+    } else if (type == kArgumentType_Object) {
+      CFTypeRef object;
+      memcpy(&object, arguments, sizeof(CFTypeRef));
+      if (object) {
+        CFRelease(object);
+      }
+      arguments += sizeof(CFTypeRef);
+    } else {
+      arguments += _ArgumentValueSize(type);
+    }
+  }
+}
+
+@implementation XLDeferredMessage {
+  NSString* _format;
+  const char* _formatString;  // NULL if created from already formatted bytes stored in place of the arguments
+  unsigned char* _arguments;
+  size_t _argumentsLength;
+  CFTypeRef _string;
+}
+
++ (const char*)capturableStringForFormat:(NSString*)format {
+  const char* formatString = CFStringGetCStringPtr((CFStringRef)format, kCFStringEncodingUTF8);
+  if (formatString == NULL) {
+    formatString = CFStringGetCStringPtr((CFStringRef)format, kCFStringEncodingMacRoman);  // Constant strings are typically stored in the system encoding which is an ASCII superset
+  }
+  return formatString && _IsFormatCapturable(formatString) ? formatString : NULL;
+}
+
++ (NSString*)messageWithFormat:(NSString*)format arguments:(va_list)arguments {
+  const char* formatString = [self capturableStringForFormat:format];
+  return formatString ? [self messageWithFormat:format capturableString:formatString arguments:arguments] : nil;
+}
+
++ (NSString*)messageWithFormat:(NSString*)format capturableString:(const char*)formatString arguments:(va_list)arguments {
+  unsigned char storage[256];
+  XLByteBuffer buffer;
+  XLByteBufferInit(&buffer, storage, sizeof(storage));
+  va_list copy;
+  va_copy(copy, arguments);  // Leave the caller's argument list untouched
+  _CaptureArguments(formatString, copy, &buffer);
+  va_end(copy);
+
+  XLDeferredMessage* message = [class_createInstance(self, buffer.length) init];  // Store the arguments inline to only need a single allocation
+  message->_format = format;
+  message->_formatString = formatString;
+  message->_argumentsLength = buffer.length;
+  if (buffer.length) {
+    message->_arguments = _GetExtraBytes(message);
+    memcpy(message->_arguments, buffer.bytes, buffer.length);
+  }
+  XLByteBufferDestroy(&buffer);
+  return message;
+}
+
++ (NSString*)messageWithUTF8Bytes:(const char*)bytes length:(size_t)length {
+  XLDeferredMessage* message = [class_createInstance(self, length) init];
+  message->_argumentsLength = length;
+  if (length) {
+    message->_arguments = _GetExtraBytes(message);
+    memcpy(message->_arguments, bytes, length);
+  }
+  return message;
+}
+
+- (void)dealloc {
+  if (_arguments && _formatString) {
+    _ReleaseCapturedArguments(_formatString, _arguments);
+  }
+  if (_string) {
+    CFRelease(_string);
+  }
+}
+
+// Formatting may happen concurrently on multiple logger queues so only the first result is kept
+- (NSString*)_formattedString {
+  CFTypeRef string = __atomic_load_n(&_string, __ATOMIC_ACQUIRE);
+  if (string == NULL) {
+    NSString* formattedString;
+    if (_formatString) {
+      formattedString = _FormatCapturedArguments(_formatString, _arguments);
+    } else {
+      formattedString = [[NSString alloc] initWithBytes:_arguments length:_argumentsLength encoding:NSUTF8StringEncoding];
+      if (formattedString == nil) {
+        formattedString = [[NSString alloc] initWithBytes:_arguments length:_argumentsLength encoding:NSMacOSRomanStringEncoding];  // C strings are not necessarily UTF-8
+      }
+    }
+    CFTypeRef newString = CFBridgingRetain(formattedString);
+    if (__atomic_compare_exchange_n(&_string, &string, newString, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      string = newString;
+    } else {
+      CFRelease(newString);
+    }
+  }
+  return (__bridge NSString*)string;
+}
+
+- (NSUInteger)estimatedSize {
+  NSUInteger size = class_getInstanceSize([self class]) + _argumentsLength;
+  CFTypeRef string = __atomic_load_n(&_string, __ATOMIC_ACQUIRE);
+  if (string) {
+    size += (NSUInteger)CFStringGetLength((CFStringRef)string) * sizeof(unichar);
+  }
+  return size;
+}
+
+- (NSUInteger)length {
+  return [[self _formattedString] length];
+}
+
+- (unichar)characterAtIndex:(NSUInteger)index {
+  return [[self _formattedString] characterAtIndex:index];
+}
+
+- (void)getCharacters:(unichar*)buffer range:(NSRange)range {
+  [[self _formattedString] getCharacters:buffer range:range];
+}
+
+- (const char*)UTF8String {
+  return [[self _formattedString] UTF8String];
+}
+
+- (id)copyWithZone:(NSZone*)zone {
+  return [self _formattedString];
+}
+
+@end
@@ -47,6 +47,16 @@ typedef void (^XLLoggerFenceBlock)();
  */
 typedef BOOL (^XLLogRecordFilterBlock)(XLLogger* logger, XLLogRecord* record);
 
+/**
+ *  The policies available to XLLogger when its queue of pending log records is full.
+ */
+typedef NS_ENUM(int, XLLoggerOverflowPolicy) {
+  kXLLoggerOverflowPolicy_Block = 0,
+  kXLLoggerOverflowPolicy_DropNewest,
+  kXLLoggerOverflowPolicy_DropOldest,
+  kXLLoggerOverflowPolicy_DropBelowLevel
+};
+
 /**
  *  The default format string for XLFacility ("%t [%L]> %m%c").
  */
@@ -57,6 +67,12 @@ extern NSString* const XLLoggerFormatString_Default;
  */
 extern NSString* const XLLoggerFormatString_NSLog;
 
+/**
+ *  The format string to output each record as a single-line JSON object ("%J")
+ *  i.e. JSON Lines when "appendNewlineToFormat" is YES.
+ */
+extern NSString* const XLLoggerFormatString_JSONLines;
+
 /**
  *  The XLLogger class is an abstract class for loggers that receive log records
  *  from XLFacility: it cannot be used directly.
@@ -89,6 +105,93 @@ extern NSString* const XLLoggerFormatString_NSLog;
  */
 @property(nonatomic, copy, nullable) XLLogRecordFilterBlock logRecordFilter;
 
+/**
+ *  Sets if the logger is durable i.e. if the thread logging a message at ERROR
+ *  level or above should wait until the logger has processed the log record
+ *  before returning, which ensures it is persisted if the process crashes
+ *  right after.
+ *
+ *  The wait is bounded by the "durableLoggersTimeout" property of XLFacility.
+ *
+ *  The default value is NO except for XLFileLogger and XLDatabaseLogger.
+ */
+@property(nonatomic, getter=isDurable) BOOL durable;
+
+/**
+ *  Sets the maximum number of log records that can be delivered at once to
+ *  -logRecords:.
+ *
+ *  Values greater than 1 enable batching: log records received from XLFacility
+ *  are accumulated in a per-logger queue and delivered in batches to
+ *  -logRecords: instead of one at a time to -logRecord:.
+ *
+ *  The default value is 1.
+ */
+@property(nonatomic) NSUInteger maxBatchSize;
+
+/**
+ *  Sets how long log records can be held in the logger's queue to accumulate
+ *  a batch before being delivered.
+ *
+ *  If this value is zero, a batch is made of whatever log records are already
+ *  pending when the logger processes its queue. Log records at ERROR level or
+ *  above are always delivered immediately.
+ *
+ *  The default value is 0.0.
+ */
+@property(nonatomic) NSTimeInterval maxBatchLatency;
+
+/**
+ *  Sets the maximum number of log records that can be pending in the logger's
+ *  queue before "overflowPolicy" applies.
+ *
+ *  The default value is 0 (unlimited).
+ */
+@property(nonatomic) NSUInteger maxPendingRecords;
+
+/**
+ *  Sets the maximum approximate memory size in bytes of the log records that
+ *  can be pending in the logger's queue before "overflowPolicy" applies.
+ *
+ *  The default value is 0 (unlimited).
+ */
+@property(nonatomic) NSUInteger maxPendingBytes;
+
+/**
+ *  Sets what happens to a log record received while the logger's queue is full:
+ *
+ *  - kXLLoggerOverflowPolicy_Block: the logging thread waits until there is room
+ *    before sending the log record to any logger (log records already on their
+ *    way to the logger from other threads can still exceed the limits)
+ *  - kXLLoggerOverflowPolicy_DropNewest: the new log record is dropped
+ *  - kXLLoggerOverflowPolicy_DropOldest: the oldest pending log records are dropped
+ *  - kXLLoggerOverflowPolicy_DropBelowLevel: log records below "overflowLevel"
+ *    are dropped starting with the new one then the oldest pending ones, while
+ *    the others are always accepted
+ *
+ *  Once the queue has been drained, a WARNING log record reporting how many log
+ *  records were dropped is delivered to the logger.
+ *
+ *  The default value is kXLLoggerOverflowPolicy_Block.
+ *
+ *  @warning Blocking policies can stall the entire logging pipeline if the
+ *  logger never makes progress.
+ */
+@property(nonatomic) XLLoggerOverflowPolicy overflowPolicy;
+
+/**
+ *  Sets the log level used by kXLLoggerOverflowPolicy_DropBelowLevel.
+ *
+ *  The default value is ERROR.
+ */
+@property(nonatomic) XLLogLevel overflowLevel;
+
+/**
+ *  Returns the total number of log records dropped by the logger because its
+ *  queue was full.
+ */
+@property(nonatomic, readonly) NSUInteger droppedRecordCount;
+
 /**
  *  Executes a "fence" block on the logger's internal CGD serial queue
  *  after all the pending log records have been processed.
@@ -101,7 +204,7 @@ extern NSString* const XLLoggerFormatString_NSLog;
  *  These methods are the ones to be implemented by subclasses.
  *
  *  @warning Each logger has its own internal GCD serial queue and -open,
- *  -logRecord: and -close are always executed on it.
+ *  -logRecord:, -logRecords: and -close are always executed on it.
  */
 @interface XLLogger (Subclassing)
 
@@ -121,6 +224,22 @@ extern NSString* const XLLoggerFormatString_NSLog;
  */
 - (void)logRecord:(XLLogRecord*)record;
 
+/**
+ *  Called whenever a batch of log records is received from XLFacility which
+ *  only happens if "maxBatchSize" is greater than 1.
+ *
+ *  The default implementation calls -logRecord: for each log record.
+ */
+- (void)logRecords:(NSArray<XLLogRecord*>*)records;
+
+/**
+ *  Called to write out log records buffered by the logger if any e.g. before
+ *  a fence block is executed.
+ *
+ *  The default implementation does nothing.
+ */
+- (void)flush;
+
 /**
  *  Called when the logger is removed from XLFacility.
  *
@@ -152,6 +271,9 @@ extern NSString* const XLLoggerFormatString_NSLog;
  *  %e: errno as an integer
  *  %E: errno as a string
  *  %c: Callstack (or nothing if not available)
+ *  %J: JSON object with the fields "time" (seconds since 1970), "tag", "level",
+ *      "message", "metadata", "errno", "thread", "queue" and "callstack" where
+ *      "tag", "metadata", "queue" and "callstack" are omitted if not available
  *
  *  \n: newline character
  *  \r: return character
@@ -182,6 +304,9 @@ extern NSString* const XLLoggerFormatString_NSLog;
  *
  *  The default format is "yyyy-MM-dd HH:mm:ss.SSS".
  *
+ *  If the format ends with ".SSS", the date-time is only rendered by the
+ *  formatter once per second and the milliseconds are appended directly.
+ *
  *  @warning Because NSDateFormatter is not thread-safe on older iOS and OS X
  *  versions, this formatter should not be configured after the logger has
  *  been added to XLFacility.
@@ -256,7 +381,7 @@ extern NSString* const XLLoggerFormatString_NSLog;
  *  Returns a sanitized version of the message from a log record.
  *
  *  The current implementation normalizes all newline characters in the message
- *  to be '\n'.
+ *  to be '\n', treating "\r\n" sequences as a single newline.
  */
 - (NSString*)sanitizeMessageFromRecord:(XLLogRecord*)record;
 
@@ -59,25 +59,56 @@ typedef NS_ENUM(unsigned char, FormatToken) {
   kFormatToken_ErrnoValue,
   kFormatToken_ErrnoString,
   kFormatToken_Callstack,
+  kFormatToken_JSON,
 
   kFormatToken_StringLUT  // Must be last token
 };
 
+#define kMaxReusableFormatBufferCapacity (256 * 1024)
+#define kDateTimeCacheCapacity 64
+
+typedef struct {
+  unsigned int sequence;  // Odd while the cache is being updated
+  int64_t second;
+  size_t length;
+  char bytes[kDateTimeCacheCapacity];
+} DateTimeCache;
+
 NSString* const XLLoggerFormatString_Default = @"%t [%L]> %m%c";
 NSString* const XLLoggerFormatString_NSLog = @"%d %P[%p:%r] %m";
+NSString* const XLLoggerFormatString_JSONLines = @"%J";
+
+static pthread_mutex_t _formatKeysMutex = PTHREAD_MUTEX_INITIALIZER;
+static CFMutableSetRef _formatKeys = NULL;
 
 static CFTimeInterval _startTime = 0.0;
+static uint64_t _startMonotonicTime = 0;
 static NSString* _pid = nil;
 static NSString* _pname = nil;
 static NSString* _uid = nil;
 
 @implementation XLLogger {
   dispatch_queue_t _lockQueue;
+  pthread_mutex_t _mailboxMutex;
+  pthread_cond_t _mailboxCondition;
+  NSMutableArray* _mailbox;
+  NSUInteger _mailboxBytes;
+  NSUInteger _mailboxWaiters;
+  NSUInteger _droppedRecordCount;
+  NSUInteger _unreportedDropCount;
+  BOOL _drainScheduled;
+  BOOL _drainDelayed;
   NSString* _format;
   BOOL _appendNewlineToFormat;
   NSMutableData* _tokens;
-  NSMutableArray* _strings;
+  NSMutableArray* _literals;
   NSDateFormatter* _datetimeFormatter;
+  DateTimeCache _datetimeCache;
+  BOOL _overridesFormatRecord;
+  BOOL _overridesSanitizeMessage;
+  BOOL _overridesFormatting;
+  const void* _formatKey;
+  XLByteBuffer _formatBuffer;
 
   NSString* _tagPlaceholder;
   NSString* _metadataPrefix;
@@ -86,11 +117,13 @@ static NSString* _uid = nil;
   NSString* _callstackHeader;
   NSString* _callstackFooter;
   NSString* _multilinesPrefix;
+  NSData* _multilinesPrefixData;
 }
 
 + (void)load {
   @autoreleasepool {
-    _startTime = CFAbsoluteTimeGetCurrent();
+    _startMonotonicTime = XLGetMonotonicTime();
+    _startTime = XLAbsoluteTimeFromMonotonicTime(_startMonotonicTime);
     _pid = [[NSString alloc] initWithFormat:@"%i", getpid()];
     _pname = [[NSString alloc] initWithFormat:@"%s", getprogname()];
     _uid = [[NSString alloc] initWithFormat:@"%i", getuid()];
@@ -101,28 +134,45 @@ static NSString* _uid = nil;
   if ((self = [super init])) {
     _serialQueue = dispatch_queue_create(XL_DISPATCH_QUEUE_LABEL, DISPATCH_QUEUE_SERIAL);
     _lockQueue = dispatch_queue_create(XL_DISPATCH_QUEUE_LABEL, DISPATCH_QUEUE_SERIAL);
+    pthread_mutex_init(&_mailboxMutex, NULL);
+    pthread_cond_init(&_mailboxCondition, NULL);
+    _mailbox = [[NSMutableArray alloc] init];
     _minLogLevel = kXLMinLogLevel;
     _maxLogLevel = kXLMaxLogLevel;
+    _maxBatchSize = 1;
+    _overflowLevel = kXLLogLevel_Error;
     _appendNewlineToFormat = YES;
     _datetimeFormatter = [[NSDateFormatter alloc] init];
     _datetimeFormatter.timeZone = [NSTimeZone systemTimeZone];
     _datetimeFormatter.dateFormat = @"yyyy-MM-dd HH:mm:ss.SSS";
     _datetimeFormatter.locale = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US"];
+    _datetimeCache.second = INT64_MIN;
     _callstackHeader = @"\n\n>>> Captured call stack:\n";
 
+    _overridesFormatRecord = ([self methodForSelector:@selector(formatRecord:)] != [XLLogger instanceMethodForSelector:@selector(formatRecord:)]);
+    _overridesSanitizeMessage = ([self methodForSelector:@selector(sanitizeMessageFromRecord:)] != [XLLogger instanceMethodForSelector:@selector(sanitizeMessageFromRecord:)]);
+    _overridesFormatting = _overridesFormatRecord || _overridesSanitizeMessage || ([self methodForSelector:@selector(formatCallstackFromRecord:)] != [XLLogger instanceMethodForSelector:@selector(formatCallstackFromRecord:)]);
+    XLByteBufferInit(&_formatBuffer, NULL, 0);
+
     self.format = XLLoggerFormatString_Default;
   }
   return self;
 }
 
-#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
-
 - (void)dealloc {
+  XLByteBufferDestroy(&_formatBuffer);
+  pthread_cond_destroy(&_mailboxCondition);
+  pthread_mutex_destroy(&_mailboxMutex);
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
   dispatch_release(_lockQueue);
   dispatch_release(_serialQueue);
+#endif
 }
 
-#endif
+- (void)setMinLogLevel:(XLLogLevel)level {
+  _minLogLevel = level;
+  [XLSharedFacility loggerLogLevelsDidChange];
+}
 
 - (BOOL)shouldLogRecord:(XLLogRecord*)record {
   if ((record.level < _minLogLevel) || (record.level > _maxLogLevel)) {
@@ -134,6 +184,65 @@ static NSString* _uid = nil;
   return YES;
 }
 
+- (BOOL)logsRecordsInline {
+  return NO;
+}
+
+- (BOOL)writesFormattedRecords {
+  return NO;
+}
+
+// Keys are never released so they can be compared by address and safely accessed from any thread
+static NSString* _InternFormatKey(NSString* key) {
+  pthread_mutex_lock(&_formatKeysMutex);
+  if (_formatKeys == NULL) {
+    _formatKeys = CFSetCreateMutable(kCFAllocatorDefault, 0, &kCFTypeSetCallBacks);
+  }
+  CFStringRef string = CFSetGetValue(_formatKeys, (__bridge CFStringRef)key);
+  if (string == NULL) {
+    string = (__bridge CFStringRef)key;
+    CFSetAddValue(_formatKeys, string);
+  }
+  pthread_mutex_unlock(&_formatKeysMutex);
+  return (__bridge NSString*)string;
+}
+
+static void _AppendFormatKeyComponent(NSMutableString* key, NSString* component) {
+  if (component) {
+    [key appendFormat:@"%lu:%@", (unsigned long)component.length, component];  // Prefix with length so components cannot be ambiguous
+  } else {
+    [key appendString:@"-"];
+  }
+}
+
+- (NSString*)formatKey {
+  const void* key = __atomic_load_n(&_formatKey, __ATOMIC_ACQUIRE);
+  if ((key == NULL) && !_overridesFormatting) {
+    NSMutableString* string = [[NSMutableString alloc] init];
+    _AppendFormatKeyComponent(string, _format);
+    _AppendFormatKeyComponent(string, _appendNewlineToFormat ? @"1" : @"0");
+    _AppendFormatKeyComponent(string, _tagPlaceholder);
+    _AppendFormatKeyComponent(string, _metadataPrefix);
+    _AppendFormatKeyComponent(string, _metadataSuffix);
+    _AppendFormatKeyComponent(string, _queueLabelPlaceholder);
+    _AppendFormatKeyComponent(string, _callstackHeader);
+    _AppendFormatKeyComponent(string, _callstackFooter);
+    _AppendFormatKeyComponent(string, _multilinesPrefix);
+    dispatch_sync(_lockQueue, ^{
+      _AppendFormatKeyComponent(string, _datetimeFormatter.dateFormat);
+      _AppendFormatKeyComponent(string, _datetimeFormatter.timeZone.name);
+      _AppendFormatKeyComponent(string, _datetimeFormatter.locale.localeIdentifier);
+    });
+    key = (__bridge const void*)_InternFormatKey(string);
+    __atomic_store_n(&_formatKey, key, __ATOMIC_RELEASE);
+  }
+  return (__bridge NSString*)key;
+}
+
+- (void)_invalidateFormatKey {
+  __atomic_store_n(&_formatKey, NULL, __ATOMIC_RELEASE);
+}
+
 - (BOOL)performOpen {
   if (!_open && [self open]) {
     _open = YES;
@@ -141,21 +250,200 @@ static NSString* _uid = nil;
   return _open;
 }
 
-- (void)performLogRecord:(XLLogRecord*)record {
-  if (_open) {
-    [self logRecord:record];
+- (NSUInteger)droppedRecordCount {
+  pthread_mutex_lock(&_mailboxMutex);
+  NSUInteger count = _droppedRecordCount;
+  pthread_mutex_unlock(&_mailboxMutex);
+  return count;
+}
+
+// Must be called with the mailbox mutex held
+- (BOOL)_isMailboxFullForSize:(NSUInteger)size {
+  if (_mailbox.count == 0) {
+    return NO;  // Always accept at least one record so a single large record cannot be stuck forever
+  }
+  if (_maxPendingRecords && (_mailbox.count >= _maxPendingRecords)) {
+    return YES;
+  }
+  if (_maxPendingBytes && (_mailboxBytes + size > _maxPendingBytes)) {
+    return YES;
+  }
+  return NO;
+}
+
+// Lets other loggers with the same format key free the formatted data they share with this one for a log record it will not format
+- (void)_discardRecord:(XLLogRecord*)record {
+  const void* key = self.sharesFormattedRecords ? __atomic_load_n(&_formatKey, __ATOMIC_ACQUIRE) : NULL;
+  if (key) {
+    [record removeFormattedDataConsumerForKey:key];
+  }
+}
+
+// Must be called with the mailbox mutex held
+- (void)_dropMailboxRecordAtIndex:(NSUInteger)index {
+  [self _discardRecord:_mailbox[index]];
+  _mailboxBytes -= [(XLLogRecord*)_mailbox[index] estimatedSize];
+  [_mailbox removeObjectAtIndex:index];
+  _droppedRecordCount += 1;
+  _unreportedDropCount += 1;
+}
+
+// Must be called on the logging thread before the log record is sent to XLFacility's ingest ring and never on XLFacility's lock queue
+// Waiting here instead of when the log record is delivered to the mailbox ensures a slow logger never stalls the other ones
+- (void)waitForRoomInMailboxForRecord:(XLLogRecord*)record {
+  if ((_overflowPolicy != kXLLoggerOverflowPolicy_Block) || (!_maxPendingRecords && !_maxPendingBytes)) {
+    return;
+  }
+  if (![self shouldLogRecord:record]) {  // Never stall the logging thread for a log record that will be rejected
+    return;
+  }
+  NSUInteger size = [record estimatedSize];
+  pthread_mutex_lock(&_mailboxMutex);
+  if ([self _isMailboxFullForSize:size]) {
+    _mailboxWaiters += 1;
+    do {
+      pthread_cond_wait(&_mailboxCondition, &_mailboxMutex);
+    } while ([self _isMailboxFullForSize:size]);
+    _mailboxWaiters -= 1;
+  }
+  pthread_mutex_unlock(&_mailboxMutex);
+}
+
+// Must be called with the mailbox mutex held
+- (BOOL)_makeRoomInMailboxForRecord:(XLLogRecord*)record size:(NSUInteger)size {
+  switch (_overflowPolicy) {
+    case kXLLoggerOverflowPolicy_Block:
+      return YES;  // The logging thread already waited in -waitForRoomInMailboxForRecord: so only log records in flight can exceed the limits
+
+    case kXLLoggerOverflowPolicy_DropNewest:
+      break;
+
+    case kXLLoggerOverflowPolicy_DropOldest:
+      do {
+        [self _dropMailboxRecordAtIndex:0];
+      } while ([self _isMailboxFullForSize:size]);
+      return YES;
+
+    case kXLLoggerOverflowPolicy_DropBelowLevel: {
+      if (record.level < _overflowLevel) {
+        break;
+      }
+      NSUInteger index = 0;
+      while ((index < _mailbox.count) && [self _isMailboxFullForSize:size]) {
+        if ([(XLLogRecord*)_mailbox[index] level] < _overflowLevel) {
+          [self _dropMailboxRecordAtIndex:index];
+        } else {
+          ++index;
+        }
+      }
+      return YES;  // Records at or above the overflow level are accepted even if the queue remains full
+    }
+  }
+  [self _discardRecord:record];
+  _droppedRecordCount += 1;
+  _unreportedDropCount += 1;
+  return NO;
+}
+
+- (XLLoggerDrain)enqueueRecord:(XLLogRecord*)record {
+  XLLoggerDrain drain = kXLLoggerDrain_None;
+  BOOL urgent = (record.level >= kXLLogLevel_Error);
+  NSUInteger size = [record estimatedSize];
+  pthread_mutex_lock(&_mailboxMutex);
+  if (![self _isMailboxFullForSize:size] || [self _makeRoomInMailboxForRecord:record size:size]) {
+    [_mailbox addObject:record];
+    _mailboxBytes += size;
+    if (!_drainScheduled) {
+      _drainScheduled = YES;
+      _drainDelayed = (_maxBatchLatency > 0.0) && !urgent;
+      drain = _drainDelayed ? kXLLoggerDrain_Delayed : kXLLoggerDrain_Immediate;
+    } else if (_drainDelayed && (urgent || (_mailbox.count >= _maxBatchSize))) {  // Don't wait for the delayed drain if the batch is full or the record is urgent
+      _drainDelayed = NO;
+      drain = kXLLoggerDrain_Immediate;
+    }
+  }
+  pthread_mutex_unlock(&_mailboxMutex);
+  return drain;
+}
+
+// Must be called on the serial queue
+- (void)_reportDroppedRecords:(NSUInteger)count {
+  XLLogLevel level = MIN(MAX(kXLLogLevel_Warning, _minLogLevel), _maxLogLevel);
+  NSString* message = [[NSString alloc] initWithFormat:@"%lu log records dropped because the queue of %@ was full", (unsigned long)count, [self class]];
+  XLLogRecord* record = [[XLLogRecord alloc] initWithMonotonicTime:XLGetMonotonicTime() tag:XLFacilityTag_Internal level:level message:message metadata:nil callstack:nil];
+  [self logRecord:record];
+}
+
+// Must be called on the serial queue
+- (void)performDrain {
+  while (1) {
+    NSArray* batch = nil;
+    XLLogRecord* record = nil;
+    NSUInteger dropCount = 0;
+    pthread_mutex_lock(&_mailboxMutex);
+    NSUInteger count = MIN(_mailbox.count, MAX(_maxBatchSize, (NSUInteger)1));
+    if (count > 1) {
+      NSRange range = NSMakeRange(0, count);
+      batch = [_mailbox subarrayWithRange:range];
+      [_mailbox removeObjectsInRange:range];
+      for (XLLogRecord* item in batch) {
+        _mailboxBytes -= [item estimatedSize];
+      }
+    } else if (count == 1) {
+      record = _mailbox[0];
+      [_mailbox removeObjectAtIndex:0];
+      _mailboxBytes -= [record estimatedSize];
+    } else {
+      _drainScheduled = NO;
+      _drainDelayed = NO;
+      dropCount = _unreportedDropCount;
+      _unreportedDropCount = 0;
+    }
+    if (count && _mailboxWaiters) {
+      pthread_cond_broadcast(&_mailboxCondition);
+    }
+    pthread_mutex_unlock(&_mailboxMutex);
+
+    if (batch) {
+      if (_open) {
+        [self logRecords:batch];
+      } else {
+        for (XLLogRecord* item in batch) {
+          [self _discardRecord:item];
+        }
+      }
+    } else if (record) {
+      if (_open) {
+        [self logRecord:record];
+      } else {
+        [self _discardRecord:record];
+      }
+    } else {
+      if (dropCount && _open) {
+        [self _reportDroppedRecords:dropCount];
+      }
+      break;
+    }
   }
 }
 
 - (void)performClose {
   if (_open) {
+    [self performDrain];  // Make sure records held for batching are not lost
     [self close];
     _open = NO;
   }
 }
 
 - (void)executeFenceBlock:(XLLoggerFenceBlock)block {
-  dispatch_async(_serialQueue, block);
+  [XLSharedFacility _flushRecords];  // Log records may still be in XLFacility's ingest ring on their way to the logger
+  dispatch_async(_serialQueue, ^{
+    [self performDrain];
+    if (_open) {
+      [self flush];
+    }
+    block();
+  });
 }
 
 @end
@@ -170,6 +458,16 @@ static NSString* _uid = nil;
   [self doesNotRecognizeSelector:_cmd];
 }
 
+- (void)logRecords:(NSArray<XLLogRecord*>*)records {
+  for (XLLogRecord* record in records) {
+    [self logRecord:record];
+  }
+}
+
+- (void)flush {
+  ;
+}
+
 - (void)close {
   ;
 }
@@ -184,9 +482,10 @@ static NSString* _uid = nil;
 
 - (void)setFormat:(NSString*)format {
   _format = [format copy];
+  [self _invalidateFormatKey];
 
   _tokens = [[NSMutableData alloc] init];
-  _strings = [[NSMutableArray alloc] init];
+  _literals = [[NSMutableArray alloc] init];
   if (_format.length) {
     NSCharacterSet* characterSet = [NSCharacterSet characterSetWithCharactersInString:@"%\\"];
     NSScanner* scanner = [NSScanner scannerWithString:_format];
@@ -196,9 +495,9 @@ static NSString* _uid = nil;
     while (1) {
       NSString* string;
       if ([scanner scanUpToCharactersFromSet:characterSet intoString:&string]) {
-        FormatToken token = kFormatToken_StringLUT + _strings.count;
+        FormatToken token = kFormatToken_StringLUT + _literals.count;
         [_tokens appendBytes:&token length:sizeof(FormatToken)];
-        [_strings addObject:string];
+        [_literals addObject:XLConvertNSStringToUTF8String(string)];  // Literals are converted to UTF-8 once here instead of for every record
       }
       if ([scanner isAtEnd]) {
         break;
@@ -278,6 +577,9 @@ static NSString* _uid = nil;
           case 'c':
             token = kFormatToken_Callstack;
             break;
+          case 'J':
+            token = kFormatToken_JSON;
+            break;
         }
       }
       if (token != kFormatToken_Unknown) {
@@ -290,6 +592,7 @@ static NSString* _uid = nil;
 
 - (void)setAppendNewlineToFormat:(BOOL)flag {
   _appendNewlineToFormat = flag;
+  [self _invalidateFormatKey];
 }
 
 - (BOOL)appendNewlineToFormat {
@@ -302,6 +605,7 @@ static NSString* _uid = nil;
 
 - (void)setTagPlaceholder:(NSString*)string {
   _tagPlaceholder = [string copy];
+  [self _invalidateFormatKey];
 }
 
 - (NSString*)tagPlaceholder {
@@ -310,6 +614,7 @@ static NSString* _uid = nil;
 
 - (void)setMetadataPrefix:(NSString*)string {
   _metadataPrefix = [string copy];
+  [self _invalidateFormatKey];
 }
 
 - (NSString*)metadataPrefix {
@@ -318,6 +623,7 @@ static NSString* _uid = nil;
 
 - (void)setMetadataSuffix:(NSString*)string {
   _metadataSuffix = [string copy];
+  [self _invalidateFormatKey];
 }
 
 - (NSString*)metadataSuffix {
@@ -326,6 +632,7 @@ static NSString* _uid = nil;
 
 - (void)setQueueLabelPlaceholder:(NSString*)string {
   _queueLabelPlaceholder = [string copy];
+  [self _invalidateFormatKey];
 }
 
 - (NSString*)queueLabelPlaceholder {
@@ -334,6 +641,7 @@ static NSString* _uid = nil;
 
 - (void)setCallstackHeader:(NSString*)string {
   _callstackHeader = [string copy];
+  [self _invalidateFormatKey];
 }
 
 - (NSString*)callstackHeader {
@@ -342,6 +650,7 @@ static NSString* _uid = nil;
 
 - (void)setCallstackFooter:(NSString*)string {
   _callstackFooter = [string copy];
+  [self _invalidateFormatKey];
 }
 
 - (NSString*)callstackFooter {
@@ -350,203 +659,484 @@ static NSString* _uid = nil;
 
 - (void)setMultilinesPrefix:(NSString*)string {
   _multilinesPrefix = [string copy];
+  _multilinesPrefixData = _multilinesPrefix.length ? XLConvertNSStringToUTF8String(_multilinesPrefix) : nil;
+  [self _invalidateFormatKey];
 }
 
 - (NSString*)multilinesPrefix {
   return _multilinesPrefix;
 }
 
+// Returns the UTF-8 bytes of the string without copying them if available
+// The byte length must come from the C string itself: it only matches the UTF-16 length for ASCII contents while NSString subclasses can return any UTF-8 C string
+static const char* _GetUTF8StringPtr(CFStringRef cfString, size_t* length) {
+  const char* cString = CFStringGetCStringPtr(cfString, kCFStringEncodingUTF8);
+  if (cString) {
+    *length = strlen(cString);
+  }
+  return cString;
+}
+
+static void _AppendString(XLByteBuffer* buffer, NSString* string) {
+  CFStringRef cfString = (__bridge CFStringRef)string;
+  CFIndex length = CFStringGetLength(cfString);
+  if (length > 0) {
+    size_t cStringLength;
+    const char* cString = _GetUTF8StringPtr(cfString, &cStringLength);
+    if (cString) {
+      XLByteBufferAppend(buffer, cString, cStringLength);
+    } else {
+      CFIndex maxLength = CFStringGetMaximumSizeForEncoding(length, kCFStringEncodingUTF8);
+      CFIndex usedLength = 0;
+      XLByteBufferReserve(buffer, (size_t)maxLength);
+      CFStringGetBytes(cfString, CFRangeMake(0, length), kCFStringEncodingUTF8, '?', false, buffer->bytes + buffer->length, maxLength, &usedLength);  // Unpaired surrogates are replaced by "?"
+      buffer->length += (size_t)usedLength;
+    }
+  }
+}
+
+static void _AppendData(XLByteBuffer* buffer, NSData* data) {
+  XLByteBufferAppend(buffer, data.bytes, data.length);
+}
+
+static void _AppendInteger(XLByteBuffer* buffer, long long value, int minDigits) {
+  char digits[24];
+  char* end = digits + sizeof(digits);
+  char* start = end;
+  unsigned long long magnitude = (value < 0 ? -(unsigned long long)value : (unsigned long long)value);
+  do {
+    *--start = (char)('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude || (end - start < minDigits));
+  if (value < 0) {
+    *--start = '-';
+  }
+  XLByteBufferAppend(buffer, start, (size_t)(end - start));
+}
+
+// Inserts the prefix after every newline that is not followed by another newline or the end of the record
+static void _AppendPrefixingLines(XLByteBuffer* buffer, const unsigned char* bytes, size_t length, NSData* prefix) {
+  const unsigned char* end = bytes + length;
+  XLByteBufferReserve(buffer, length);
+  while (bytes < end) {
+    const unsigned char* newline = memchr(bytes, '\n', (size_t)(end - bytes));
+    if (newline == NULL) {
+      XLByteBufferAppend(buffer, bytes, (size_t)(end - bytes));
+      break;
+    }
+    XLByteBufferAppend(buffer, bytes, (size_t)(newline - bytes) + 1);
+    bytes = newline + 1;
+    if ((bytes < end) && (*bytes != '\n')) {
+      XLByteBufferAppend(buffer, prefix.bytes, prefix.length);
+    }
+  }
+}
+
+// Converts "\r\n" and all other newline characters from NSCharacterSet's newlineCharacterSet i.e. "\r", "\v", "\f", U+0085, U+2028 and U+2029 to "\n"
+// Returns NO if the string was appended unchanged
+static BOOL _AppendSanitizedString(XLByteBuffer* buffer, NSString* string) {
+  size_t start = buffer->length;
+  _AppendString(buffer, string);
+  unsigned char* bytes = buffer->bytes + start;
+  unsigned char* end = buffer->bytes + buffer->length;
+  unsigned char* output = NULL;
+  while (bytes < end) {
+    if (end - bytes >= (ptrdiff_t)sizeof(uint64_t)) {  // Process 8 bytes at a time while they are all ASCII and none is below "\x0E"
+      uint64_t word;
+      memcpy(&word, bytes, sizeof(word));
+      if (!(((word - 0x0E * kXLWordLowBytes) | word) & kXLWordHighBits)) {
+        if (output) {
+          memmove(output, bytes, sizeof(word));
+          output += sizeof(word);
+        }
+        bytes += sizeof(word);
+        continue;
+      }
+    }
+    unsigned char c = *bytes;
+    size_t skip = 0;
+    if ((c >= '\n') && (c <= '\r')) {
+      skip = (c == '\r') && (bytes + 1 < end) && (bytes[1] == '\n') ? 2 : 1;
+    } else if ((c == 0xC2) && (bytes + 1 < end) && (bytes[1] == 0x85)) {
+      skip = 2;
+    } else if ((c == 0xE2) && (bytes + 2 < end) && (bytes[1] == 0x80) && ((bytes[2] == 0xA8) || (bytes[2] == 0xA9))) {
+      skip = 3;
+    }
+    if ((skip == 0) || ((c == '\n') && (output == NULL))) {  // Keep byte as-is
+      if (output) {
+        *output++ = c;
+      }
+      ++bytes;
+      continue;
+    }
+    if (output == NULL) {
+      output = bytes;  // Sanitized output is never longer than the input so it can be written in place
+    }
+    *output++ = '\n';
+    bytes += skip;
+  }
+  if (output) {
+    buffer->length = (size_t)(output - buffer->bytes);
+    return YES;
+  }
+  return NO;
+}
+
+static void _AppendJSONString(XLByteBuffer* buffer, NSString* string) {
+  size_t cStringLength;
+  const char* cString = _GetUTF8StringPtr((__bridge CFStringRef)string, &cStringLength);
+  if (cString) {
+    XLByteBufferAppendJSONBytes(buffer, cString, cStringLength);
+  } else {
+    unsigned char storage[1024];
+    XLByteBuffer utf8;
+    XLByteBufferInit(&utf8, storage, sizeof(storage));
+    _AppendString(&utf8, string);
+    XLByteBufferAppendJSONBytes(buffer, utf8.bytes, utf8.length);
+    XLByteBufferDestroy(&utf8);
+  }
+}
+
+#define APPEND_LITERAL(__BUFFER__, __LITERAL__) XLByteBufferAppend(__BUFFER__, __LITERAL__, sizeof(__LITERAL__) - 1)
+
+static void _AppendRecordAsJSON(XLByteBuffer* buffer, XLLogRecord* record) {
+  long long milliseconds = MAX(llround((record.absoluteTime + kCFAbsoluteTimeIntervalSince1970) * 1000.0), 0);
+  APPEND_LITERAL(buffer, "{\"time\":");
+  _AppendInteger(buffer, milliseconds / 1000, 1);
+  APPEND_LITERAL(buffer, ".");
+  _AppendInteger(buffer, milliseconds % 1000, 3);
+  if (record.tag) {
+    APPEND_LITERAL(buffer, ",\"tag\":");
+    _AppendJSONString(buffer, (id)record.tag);
+  }
+  APPEND_LITERAL(buffer, ",\"level\":");
+  _AppendJSONString(buffer, XLStringFromLogLevelName(record.level));
+  APPEND_LITERAL(buffer, ",\"message\":");
+  _AppendJSONString(buffer, record.message);
+  size_t length = buffer->length;
+  APPEND_LITERAL(buffer, ",\"metadata\":");
+  if (![record appendMetadataAsJSONToBuffer:buffer]) {
+    buffer->length = length;
+  }
+  APPEND_LITERAL(buffer, ",\"errno\":");
+  _AppendInteger(buffer, record.capturedErrno, 1);
+  APPEND_LITERAL(buffer, ",\"thread\":");
+  _AppendInteger(buffer, (long long)(unsigned long)record.capturedThreadID, 1);
+  if (record.capturedQueueLabel) {
+    APPEND_LITERAL(buffer, ",\"queue\":");
+    _AppendJSONString(buffer, (id)record.capturedQueueLabel);
+  }
+  NSArray* callstack = record.callstack;
+  if (callstack) {
+    APPEND_LITERAL(buffer, ",\"callstack\":[");
+    for (NSInteger i = 1, count = callstack.count; i < count - 1; ++i) {  // Skip the same frames as -formatCallstackFromRecord:
+      if (i > 1) {
+        APPEND_LITERAL(buffer, ",");
+      }
+      _AppendJSONString(buffer, callstack[i]);
+    }
+    APPEND_LITERAL(buffer, "]");
+  }
+  APPEND_LITERAL(buffer, "}");
+}
+
+// Lock-free read of the date-time rendered up to the milliseconds for the given second
+static BOOL _ReadDateTimeCache(DateTimeCache* cache, int64_t second, XLByteBuffer* buffer) {
+  char bytes[kDateTimeCacheCapacity];
+  unsigned int sequence = __atomic_load_n(&cache->sequence, __ATOMIC_ACQUIRE);
+  if ((sequence & 1) || (__atomic_load_n(&cache->second, __ATOMIC_RELAXED) != second)) {
+    return NO;
+  }
+  size_t length = __atomic_load_n(&cache->length, __ATOMIC_RELAXED);
+  memcpy(bytes, cache->bytes, MIN(length, sizeof(bytes)));
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&cache->sequence, __ATOMIC_RELAXED) != sequence) {
+    return NO;
+  }
+  XLByteBufferAppend(buffer, bytes, length);
+  return YES;
+}
+
+// Must be called on the lock queue which serializes writers
+static void _WriteDateTimeCache(DateTimeCache* cache, int64_t second, const void* bytes, size_t length) {
+  __atomic_add_fetch(&cache->sequence, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&cache->second, second, __ATOMIC_RELAXED);
+  __atomic_store_n(&cache->length, length, __ATOMIC_RELAXED);
+  memcpy(cache->bytes, bytes, length);
+  __atomic_add_fetch(&cache->sequence, 1, __ATOMIC_RELEASE);
+}
+
+// Returns YES if only the date-time up to the milliseconds was appended and the cache refreshed, which is possible when the format ends with ".SSS"
+- (BOOL)_appendDateTime:(CFAbsoluteTime)absoluteTime toBuffer:(XLByteBuffer*)buffer {
+  __block NSString* datetime;
+  __block BOOL cached = NO;
+  dispatch_sync(_lockQueue, ^{  // NSDateFormatter is not thread-safe so use serial lock in case -formatRecord: is called on multiple threads in parallel
+    NSString* format = _datetimeFormatter.dateFormat;
+    if ([format hasSuffix:@".SSS"] && ([format rangeOfCharacterFromSet:[NSCharacterSet characterSetWithCharactersInString:@"SA"] options:0 range:NSMakeRange(0, format.length - 3)].location == NSNotFound)) {
+      CFAbsoluteTime second = floor(absoluteTime);
+      datetime = [_datetimeFormatter stringFromDate:[NSDate dateWithTimeIntervalSinceReferenceDate:second]];
+      if ([datetime hasSuffix:@"000"]) {  // Make sure milliseconds are rendered as ASCII digits
+        datetime = [datetime substringToIndex:(datetime.length - 3)];
+        NSData* data = XLConvertNSStringToUTF8String(datetime);
+        if (data.length <= kDateTimeCacheCapacity) {
+          _WriteDateTimeCache(&_datetimeCache, (int64_t)second, data.bytes, data.length);
+        }
+        cached = YES;
+        return;
+      }
+    }
+    datetime = [_datetimeFormatter stringFromDate:[NSDate dateWithTimeIntervalSinceReferenceDate:absoluteTime]];
+  });
+  if (datetime.length) {
+    _AppendString(buffer, datetime);
+  }
+  return cached;
+}
+
 static void _MetadataApplier(const void* key, const void* value, void* context) {
-  NSMutableString* string = (__bridge NSMutableString*)context;
-  [string appendString:@"  "];
-  [string appendString:(__bridge NSString*)key];
-  [string appendString:@": "];
-  [string appendString:(__bridge NSString*)value];
-  [string appendString:@"\n"];
+  XLByteBuffer* buffer = (XLByteBuffer*)context;
+  XLByteBufferAppend(buffer, "  ", 2);
+  _AppendString(buffer, (__bridge NSString*)key);
+  XLByteBufferAppend(buffer, ": ", 2);
+  _AppendString(buffer, (__bridge NSString*)value);
+  XLByteBufferAppend(buffer, "\n", 1);
 }
 
-- (NSString*)formatRecord:(XLLogRecord*)record {
-  NSMutableString* string = [[NSMutableString alloc] initWithCapacity:(2 * record.message.length)];  // Should be quite enough
+- (void)_appendTokensForRecord:(XLLogRecord*)record toBuffer:(XLByteBuffer*)buffer {
+  XLByteBufferReserve(buffer, 2 * record.message.length);  // Should be quite enough
 
   const FormatToken* token = (const FormatToken*)_tokens.bytes;
   for (int i = 0; i < (int)(_tokens.length / sizeof(FormatToken)); ++i, ++token) {
     switch (*token) {
       case kFormatToken_Newline: {
-        [string appendString:@"\n"];
+        XLByteBufferAppend(buffer, "\n", 1);
         break;
       }
 
       case kFormatToken_Return: {
-        [string appendString:@"\r"];
+        XLByteBufferAppend(buffer, "\r", 1);
         break;
       }
 
       case kFormatToken_Tab: {
-        [string appendString:@"\t"];
+        XLByteBufferAppend(buffer, "\t", 1);
         break;
       }
 
       case kFormatToken_Percent: {
-        [string appendString:@"%"];
+        XLByteBufferAppend(buffer, "%", 1);
         break;
       }
 
       case kFormatToken_Backslash: {
-        [string appendString:@"\\"];
+        XLByteBufferAppend(buffer, "\\", 1);
         break;
       }
 
       case kFormatToken_Tag: {
         if (record.tag) {
-          [string appendString:(id)record.tag];
+          _AppendString(buffer, (id)record.tag);
         } else if (_tagPlaceholder) {
-          [string appendString:_tagPlaceholder];
+          _AppendString(buffer, _tagPlaceholder);
         }
         break;
       }
 
       case kFormatToken_LevelName: {
-        [string appendString:XLStringFromLogLevelName(record.level)];
+        _AppendString(buffer, XLStringFromLogLevelName(record.level));
         break;
       }
 
       case kFormatToken_PaddedLevelName: {
-        [string appendString:XLPaddedStringFromLogLevelName(record.level)];
+        _AppendString(buffer, XLPaddedStringFromLogLevelName(record.level));
         break;
       }
 
       case kFormatToken_Message: {
-        [string appendString:record.message];
+        _AppendString(buffer, record.message);
         break;
       }
 
       case kFormatToken_SanitizedMessage: {
-        [string appendString:[self sanitizeMessageFromRecord:record]];
+        if (_overridesSanitizeMessage) {
+          _AppendString(buffer, [self sanitizeMessageFromRecord:record]);
+        } else {
+          _AppendSanitizedString(buffer, record.message);
+        }
         break;
       }
 
       case kFormatToken_Metadata: {
         if (record.metadata) {
           if (_metadataPrefix) {
-            [string appendString:_metadataPrefix];
+            _AppendString(buffer, _metadataPrefix);
           }
-          [string appendString:@"{\n"];
-          CFDictionaryApplyFunction((CFDictionaryRef)record.metadata, _MetadataApplier, (__bridge void*)string);
-          [string appendString:@"}"];
+          XLByteBufferAppend(buffer, "{\n", 2);
+          CFDictionaryApplyFunction((CFDictionaryRef)record.metadata, _MetadataApplier, buffer);
+          XLByteBufferAppend(buffer, "}", 1);
           if (_metadataSuffix) {
-            [string appendString:_metadataSuffix];
+            _AppendString(buffer, _metadataSuffix);
           }
         }
         break;
       }
 
       case kFormatToken_UserID: {
-        [string appendString:_uid];
+        _AppendString(buffer, _uid);
         break;
       }
 
       case kFormatToken_ProcessID: {
-        [string appendString:_pid];
+        _AppendString(buffer, _pid);
         break;
       }
 
       case kFormatToken_ProcessName: {
-        [string appendString:_pname];
+        _AppendString(buffer, _pname);
         break;
       }
 
       case kFormatToken_ThreadID: {
-        [string appendFormat:@"%lu", (unsigned long)record.capturedThreadID];
+        _AppendInteger(buffer, (long long)(unsigned long)record.capturedThreadID, 1);
         break;
       }
 
       case kFormatToken_QueueLabel: {
         if (record.capturedQueueLabel) {
-          [string appendString:(id)record.capturedQueueLabel];
+          _AppendString(buffer, (id)record.capturedQueueLabel);
         } else if (_queueLabelPlaceholder) {
-          [string appendString:_queueLabelPlaceholder];
+          _AppendString(buffer, _queueLabelPlaceholder);
         }
         break;
       }
 
       case kFormatToken_Timestamp: {
-        CFTimeInterval timestamp = record.absoluteTime - _startTime;
+        CFTimeInterval timestamp;
+        if (record.monotonicTime >= _startMonotonicTime) {
+          timestamp = (double)(record.monotonicTime - _startMonotonicTime) / (double)NSEC_PER_SEC;
+        } else {
+          timestamp = MAX(record.absoluteTime - _startTime, 0.0);  // Records without monotonic time e.g. read back from a database
+        }
         int milliseconds = fmod(timestamp, 1.0) * 1000.0;
         int seconds = timestamp;
         int minutes = seconds / 60;
         seconds -= minutes * 60;
         int hours = minutes / 60;
         minutes -= hours * 60;
-        [string appendFormat:@"%02i:%02i:%02i.%03i", hours, minutes, seconds, milliseconds];
+        _AppendInteger(buffer, hours, 2);
+        XLByteBufferAppend(buffer, ":", 1);
+        _AppendInteger(buffer, minutes, 2);
+        XLByteBufferAppend(buffer, ":", 1);
+        _AppendInteger(buffer, seconds, 2);
+        XLByteBufferAppend(buffer, ".", 1);
+        _AppendInteger(buffer, milliseconds, 3);
         break;
       }
 
       case kFormatToken_DateTime: {
-        __block NSString* datetime;
-        dispatch_sync(_lockQueue, ^{
-          datetime = [_datetimeFormatter stringFromDate:[NSDate dateWithTimeIntervalSinceReferenceDate:record.absoluteTime]];  // NSDateFormatter is not thread-safe so use serial lock in case -formatRecord: is called on multiple threads in parallel
-        });
-        if (datetime.length) {
-          [string appendString:datetime];
+        CFAbsoluteTime absoluteTime = record.absoluteTime;
+        CFAbsoluteTime second = floor(absoluteTime);
+        if (_ReadDateTimeCache(&_datetimeCache, (int64_t)second, buffer) || [self _appendDateTime:absoluteTime toBuffer:buffer]) {
+          _AppendInteger(buffer, MIN((int)((absoluteTime - second) * 1000.0), 999), 3);
         }
         break;
       }
 
       case kFormatToken_ErrnoValue: {
-        [string appendFormat:@"%i", record.capturedErrno];
+        _AppendInteger(buffer, record.capturedErrno, 1);
         break;
       }
 
       case kFormatToken_ErrnoString: {
-        [string appendFormat:@"%s", strerror(record.capturedErrno)];
+        const char* string = strerror(record.capturedErrno);
+        XLByteBufferAppend(buffer, string, strlen(string));
         break;
       }
 
       case kFormatToken_Callstack: {
         NSString* callstack = [self formatCallstackFromRecord:record];
         if (callstack) {
-          [string appendString:callstack];
+          _AppendString(buffer, callstack);
         }
         break;
       }
 
+      case kFormatToken_JSON: {
+        _AppendRecordAsJSON(buffer, record);
+        break;
+      }
+
       default: {
         if (*token >= kFormatToken_StringLUT) {
-          [string appendString:_strings[*token - kFormatToken_StringLUT]];
+          _AppendData(buffer, _literals[*token - kFormatToken_StringLUT]);
         }
         break;
       }
     }
   }
+}
 
-  if (_multilinesPrefix.length) {
-    NSArray* components = [string componentsSeparatedByString:@"\n"];
-    if (components.count != 1) {
-      [string replaceCharactersInRange:NSMakeRange(0, string.length) withString:@""];
-      [components enumerateObjectsUsingBlock:^(NSString* component, NSUInteger idx, BOOL* stop) {
-        if (idx > 0) {
-          [string appendString:@"\n"];
-        }
-        if (component.length) {
-          if (idx > 0) {
-            [string appendString:_multilinesPrefix];
-          }
-          [string appendString:component];
-        }
-      }];
-    }
+- (void)_appendRecord:(XLLogRecord*)record toBuffer:(XLByteBuffer*)buffer {
+  if (_multilinesPrefixData) {
+    unsigned char storage[1024];
+    XLByteBuffer lines;
+    XLByteBufferInit(&lines, storage, sizeof(storage));
+    [self _appendTokensForRecord:record toBuffer:&lines];
+    _AppendPrefixingLines(buffer, lines.bytes, lines.length, _multilinesPrefixData);
+    XLByteBufferDestroy(&lines);
+  } else {
+    [self _appendTokensForRecord:record toBuffer:buffer];
   }
 
   if (_appendNewlineToFormat) {
-    [string appendString:@"\n"];
+    XLByteBufferAppend(buffer, "\n", 1);
   }
+}
 
+- (NSString*)formatRecord:(XLLogRecord*)record {
+  char storage[1024];
+  XLByteBuffer buffer;
+  XLByteBufferInit(&buffer, storage, sizeof(storage));
+  [self _appendRecord:record toBuffer:&buffer];
+  NSString* string = [[NSString alloc] initWithBytes:buffer.bytes length:buffer.length encoding:NSUTF8StringEncoding];
+  XLByteBufferDestroy(&buffer);
   return string;
 }
 
+- (void)appendFormattedRecord:(XLLogRecord*)record toBuffer:(XLByteBuffer*)buffer {
+  NSString* key = self.sharesFormattedRecords ? [self formatKey] : nil;
+  if (key) {  // Reuse the bytes formatted by another logger with the same format key if available
+    [record appendFormattedDataForKey:(__bridge const void*)key
+                             toBuffer:buffer
+                           usingBlock:^{
+                             [self _appendRecord:record toBuffer:buffer];
+                           }];
+  } else if (_overridesFormatRecord) {
+    _AppendString(buffer, [self formatRecord:record]);
+  } else {
+    [self _appendRecord:record toBuffer:buffer];
+  }
+}
+
+- (XLByteBuffer*)reusableFormatBuffer {
+  if (_formatBuffer.capacity > kMaxReusableFormatBufferCapacity) {
+    XLByteBufferDestroy(&_formatBuffer);  // Don't hold onto the memory used by an unusually large record or batch
+  }
+  _formatBuffer.length = 0;
+  return &_formatBuffer;
+}
+
 - (NSString*)sanitizeMessageFromRecord:(XLLogRecord*)record {
-  NSArray* components = [record.message componentsSeparatedByCharactersInSet:[NSCharacterSet newlineCharacterSet]];
-  return (components.count > 1 ? [components componentsJoinedByString:@"\n"] : record.message);
+  NSString* message = record.message;
+  unsigned char storage[1024];
+  XLByteBuffer buffer;
+  XLByteBufferInit(&buffer, storage, sizeof(storage));
+  if (_AppendSanitizedString(&buffer, message)) {
+    message = [[NSString alloc] initWithBytes:buffer.bytes length:buffer.length encoding:NSUTF8StringEncoding];
+  }
+  XLByteBufferDestroy(&buffer);
+  return message;
 }
 
 - (NSString*)formatCallstackFromRecord:(XLLogRecord*)record {
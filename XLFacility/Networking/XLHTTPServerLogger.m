@@ -36,6 +36,62 @@
 #define kMinRefreshDelay 500  // In milliseconds
 #define kMaxLongPollDuration 30  // In seconds
 
+// Escapes the string in a single pass over its UTF-8 bytes, checking 8 bytes at a time, and returns it unchanged if there is nothing to escape
+static NSString* _EscapeHTMLString(NSString* string) {
+  const unsigned char* bytes = (const unsigned char*)XLConvertNSStringToUTF8CString(string);
+  const unsigned char* end = bytes + strlen((const char*)bytes);
+  const unsigned char* pending = bytes;
+  unsigned char storage[1024];
+  XLByteBuffer buffer;
+  BOOL escaped = NO;
+  while (bytes < end) {
+    if (end - bytes >= (ptrdiff_t)sizeof(uint64_t)) {
+      uint64_t word;
+      memcpy(&word, bytes, sizeof(word));
+      if (!(XLWordHasByte(word, '<') | XLWordHasByte(word, '>') | XLWordHasByte(word, '&') | XLWordHasByte(word, '"') | XLWordHasByte(word, '\n'))) {
+        bytes += sizeof(word);
+        continue;
+      }
+    }
+    const char* replacement = NULL;
+    switch (*bytes) {
+      case '<':
+        replacement = "&lt;";
+        break;
+      case '>':
+        replacement = "&gt;";
+        break;
+      case '&':
+        replacement = "&amp;";
+        break;
+      case '"':
+        replacement = "&quot;";
+        break;
+      case '\n':
+        replacement = "<br>";
+        break;
+    }
+    if (replacement) {
+      if (!escaped) {
+        XLByteBufferInit(&buffer, storage, sizeof(storage));
+        XLByteBufferReserve(&buffer, (size_t)(end - pending) + 64);
+        escaped = YES;
+      }
+      XLByteBufferAppend(&buffer, pending, (size_t)(bytes - pending));
+      XLByteBufferAppend(&buffer, replacement, strlen(replacement));
+      pending = bytes + 1;
+    }
+    ++bytes;
+  }
+  if (!escaped) {
+    return string;
+  }
+  XLByteBufferAppend(&buffer, pending, (size_t)(end - pending));
+  NSString* result = [[NSString alloc] initWithBytes:buffer.bytes length:buffer.length encoding:NSUTF8StringEncoding];
+  XLByteBufferDestroy(&buffer);
+  return result;
+}
+
 @interface XLHTTPServerLogger ()
 @property(nonatomic, readonly) NSDateFormatter* dateFormatterRFC822;
 @end
@@ -295,18 +351,12 @@
 }
 
 - (NSString*)sanitizeMessageFromRecord:(XLLogRecord*)record {
-  NSString* message = [super sanitizeMessageFromRecord:record];
-  message = [message stringByReplacingOccurrencesOfString:@"<" withString:@"&lt;"];
-  message = [message stringByReplacingOccurrencesOfString:@">" withString:@"&gt;"];
-  message = [message stringByReplacingOccurrencesOfString:@"&" withString:@"&amp;"];
-  message = [message stringByReplacingOccurrencesOfString:@"\n" withString:@"<br>"];
-  return message;
+  return _EscapeHTMLString([super sanitizeMessageFromRecord:record]);
 }
 
 - (NSString*)formatCallstackFromRecord:(XLLogRecord*)record {
   NSString* callstack = [super formatCallstackFromRecord:record];
-  callstack = [callstack stringByReplacingOccurrencesOfString:@"\n" withString:@"<br>"];
-  return callstack;
+  return callstack ? _EscapeHTMLString(callstack) : nil;
 }
 
 - (void)logRecord:(XLLogRecord*)record {
@@ -317,4 +367,12 @@
   }];
 }
 
+- (void)logRecords:(NSArray<XLLogRecord*>*)records {
+  [super logRecords:records];
+
+  [self.TCPServer enumerateConnectionsUsingBlock:^(GCDTCPPeerConnection* connection, BOOL* stop) {
+    [(XLHTTPServerConnection*)connection didReceiveLogRecord];
+  }];
+}
+
 @end
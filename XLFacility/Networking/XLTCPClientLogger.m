@@ -60,7 +60,10 @@ static void* _associatedObjectKey = &_associatedObjectKey;
 }
 
 - (void)writeLogString:(NSString*)string withTimeout:(NSTimeInterval)timeout {
-  NSData* data = XLConvertNSStringToUTF8String(string);
+  [self writeLogData:XLConvertNSStringToUTF8String(string) withTimeout:timeout];
+}
+
+- (void)writeLogData:(NSData*)data withTimeout:(NSTimeInterval)timeout {
   if (timeout < 0.0) {
     [self writeDataAsynchronously:data
                        completion:^(BOOL success) {
@@ -132,7 +135,32 @@ static void* _associatedObjectKey = &_associatedObjectKey;
     [_databaseLogger logRecord:record];
   }
 
-  [_TCPClient.connection writeLogString:[self formatRecord:record] withTimeout:_sendTimeout];
+  GCDTCPClientConnection* connection = _TCPClient.connection;
+  if (connection) {
+    XLByteBuffer* buffer = [self reusableFormatBuffer];
+    [self appendFormattedRecord:record toBuffer:buffer];
+    [connection writeLogData:[[NSData alloc] initWithBytes:buffer->bytes length:buffer->length] withTimeout:_sendTimeout];
+  }
+}
+
+// Send the entire batch with a single write
+- (void)logRecords:(NSArray<XLLogRecord*>*)records {
+  if (_databaseLogger) {
+    [_databaseLogger logRecords:records];
+  }
+
+  GCDTCPClientConnection* connection = _TCPClient.connection;
+  if (connection) {
+    XLByteBuffer* buffer = [self reusableFormatBuffer];
+    for (XLLogRecord* record in records) {
+      [self appendFormattedRecord:record toBuffer:buffer];
+    }
+    [connection writeLogData:[[NSData alloc] initWithBytes:buffer->bytes length:buffer->length] withTimeout:_sendTimeout];
+  }
+}
+
+- (BOOL)writesFormattedRecords {
+  return YES;
 }
 
 - (void)close {
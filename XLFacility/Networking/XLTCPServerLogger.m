@@ -91,6 +91,12 @@ static void* _associatedObjectKey = &_associatedObjectKey;
   }
 }
 
+- (void)logRecords:(NSArray<XLLogRecord*>*)records {
+  if (_databaseLogger) {
+    [_databaseLogger logRecords:records];
+  }
+}
+
 - (void)close {
   [_TCPServer stop];
 
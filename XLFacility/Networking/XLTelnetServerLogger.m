@@ -131,10 +131,7 @@
   return formattedMessage;
 }
 
-- (void)logRecord:(XLLogRecord*)record {
-  [super logRecord:record];
-
-  NSString* formattedMessage = [self formatRecord:record];
+- (void)_writeStringToConnections:(NSString*)formattedMessage {
   [self.TCPServer enumerateConnectionsUsingBlock:^(GCDTCPPeerConnection* connection, BOOL* stop) {
     NSString* string = [(GCDTelnetConnection*)connection sanitizeStringForTerminal:formattedMessage];
     if (_sendTimeout < 0.0) {
@@ -152,4 +149,21 @@
   }];
 }
 
+- (void)logRecord:(XLLogRecord*)record {
+  [super logRecord:record];
+
+  [self _writeStringToConnections:[self formatRecord:record]];
+}
+
+// Send the entire batch with a single write per connection
+- (void)logRecords:(NSArray<XLLogRecord*>*)records {
+  [super logRecords:records];
+
+  NSMutableString* string = [[NSMutableString alloc] init];
+  for (XLLogRecord* record in records) {
+    [string appendString:[self formatRecord:record]];
+  }
+  [self _writeStringToConnections:string];
+}
+
 @end